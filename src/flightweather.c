@@ -2,25 +2,42 @@
 #include <pebble.h>
 #include <string.h>
 #include "PDutils.h"
+#include "schedule.h"
+#include "performance.h"
+#include "runway.h"
+#include "phrases.h"
+#include "log.h"
+#include "src/message_schema.auto.h"        // Keys for app message, generated from appinfo.json by tools/schema.py.
 
 #define MINUTES 60 * 1000
 
 #define MAX_TIME_BETWEEN_UPDATES 70
-#define LOCATION_INTERVAL 20
-
-#define HIGH_INTERVAL 1
-#define LOW_INTERVAL 14 
-#define BASE_INTERVAL 5
-#define BAT_SAVE_INTERVAL 60
-
-#define LOW_TRESHOLD 25
-#define HIGH_TRESHOLD 37 
 
 #define TEXT_LAYER_Y 78
 
 #define LAYER_TIMERS 10
 
 #define SCROLL_INTERVAL 10 * 1000
+
+#define RECONNECT_MIN_DELAY 5 * 1000
+#define RECONNECT_MAX_DELAY 10 * MINUTES
+
+#define HISTORY_LENGTH 24
+#define HISTORY_WRITE_BATCH 4
+#define HISTORY_PERSIST_KEY 0x100
+
+#define TREND_TIMEOUT 10 * 1000
+#define DECODED_SIZE 256                // Bytes of the decoded view of a report.
+
+// Smallest changes between two reports that are worth an alert. Smaller changes also count when they are at least
+// a quarter of the value, so that e.g. a ceiling going from 300 to 200 ft does, but not below the floor, so that
+// wind going from 3 to 4 kt does not.
+#define CEILING_STEP 500
+#define CEILING_FLOOR 0
+#define VISIBILITY_STEP 1000
+#define VISIBILITY_FLOOR 0
+#define WIND_STEP 10
+#define WIND_FLOOR 5
 /*}}}*/
 
 //Data structures {{{
@@ -28,6 +45,54 @@ typedef struct {
     Layer *layer;
     AppTimer *timer;
 } LayerTimer;
+
+// A packed weather observation. Values that don't fit are capped, unknown values are 255.
+typedef struct {
+    uint32_t time;              // Issue time of the metar.
+    uint8_t ceiling;            // Hundreds of feet. 255 if there is no ceiling.
+    uint8_t visibility;         // Hundreds of meters, capped at 100.
+    uint8_t wind;               // Knots.
+    uint8_t category;
+} Observation;
+
+// Counters of what the app spends battery on. Sent to the phone as is in STATS_KEY, so only add uint32_t fields
+// at the end, and update decodeStats in pebble-js-app.js to match.
+typedef struct {
+    uint32_t tick_wakeups;
+    uint32_t inbox_wakeups;
+    uint32_t outbox_wakeups;
+    uint32_t bluetooth_wakeups;
+    uint32_t tap_wakeups;
+    uint32_t messages_in;
+    uint32_t messages_out;
+    uint32_t bytes_in;
+    uint32_t bytes_out;
+    uint32_t outbox_failures;
+    uint32_t inbox_dropped;
+    uint32_t timer_fires;
+    uint32_t redraws;
+    uint32_t animation_ms;
+    uint32_t alerts;
+    uint32_t vibrations;
+    uint32_t deferred_minutes;                  // Minutes that due requests were held back by the energy budget.
+} Counters;
+
+// The conditions of a report, for comparing it with the one before.
+typedef struct {
+    int32_t category;
+    int32_t ceiling;
+    int32_t visibility;
+    int32_t wind;
+    int32_t weather;
+} Conditions;
+
+// Ring of the last HISTORY_LENGTH observations. Saved to persistent storage as is, so it has to fit in
+// PERSIST_DATA_MAX_LENGTH.
+typedef struct {
+    uint8_t head;               // Slot that the next observation is written to.
+    uint8_t count;
+    Observation entries[HISTORY_LENGTH];
+} History;
 // }}}
 
 //UI elements {{{
@@ -41,6 +106,8 @@ static PropertyAnimation *weather_animation;
 static TextLayer *clock_layer;
 static TextLayer *date_layer;
 static TextLayer *metar_age_layer;
+
+static Layer *trend_layer;                      // Shows the history of the weather when the watch is tapped.
 // }}}
 
 //The status layer and its icons. {{{
@@ -68,8 +135,8 @@ static GBitmap *imc_icon;
 
 // The dialog layer {{{
 static Layer *dialog_layer;
-char* dialog_message = NULL;
-char* dialog_title = NULL;
+static char dialog_message[48];
+const char* dialog_title = NULL;
 // }}}
 
 //Timers {{{
@@ -86,26 +153,70 @@ static LayerTimer *layer_timers;
 //Data variables {{{
 
 //Saved timestamps for update cycle. {{{
-static time_t last_weather_update = 0;
-static time_t last_weather_check = 0;
-static time_t last_location = 0;
+static Schedule schedule;                       // When to request metars and locations. See schedule.c.
 static time_t metar_update_time = 0;
 // }}}
 
 //Weather and station {{{
 static char *station = NULL;
 static char *metar = NULL;
+static uint8_t *phrases = NULL;                 // The decoded view of the metar as the phone sent it. See phrases.c.
+static uint16_t phrases_length = 0;
+static char *decoded = NULL;                    // The decoded view rendered, while it is shown.
+static bool show_decoded = false;
 bool imc = false;
-int initial = 2;
+// }}}
+
+//Flight conditions, as computed by the phone {{{
+static uint8_t category = 0;
+static int32_t ceiling = -1;                    // Feet, -1 if there is no ceiling.
+static int32_t visibility = -1;                 // Meters, -1 if unknown.
+static int32_t wind = -1;                       // Knots, -1 if unknown.
+static int32_t weather = 0;                     // WX_ flags.
+// }}}
+
+//Pressure and density altitude, computed on the watch. See performance.c. {{{
+#define PERFORMANCE_NONE { PERFORMANCE_UNKNOWN, PERFORMANCE_UNKNOWN, PERFORMANCE_UNKNOWN, PERFORMANCE_UNKNOWN }
+static PerformanceInput performance_input = PERFORMANCE_NONE;  // As computed from last.
+static Performance performance = { PERFORMANCE_UNKNOWN, PERFORMANCE_UNKNOWN, PERFORMANCE_UNKNOWN };
+static char performance_text[32] = "";
+// }}}
+
+//Wind on the runways of the station. See runway.c. {{{
+static Runway runways[RUNWAY_MAX];
+static int runway_count = 0;
+static int32_t runway_variation = 0;            // Degrees, east positive.
+static int32_t wind_direction = -1;             // Degrees true, -1 if variable or unknown.
+static int32_t gust = -1;                       // Knots, -1 if there are no gusts.
+static char runway_text[32] = "";
+// }}}
+
+//SIGMET and AIRMET hazards at and ahead of the phone, as checked by the phone. {{{
+static int32_t hazard = 0;                      // As sent in HAZARD_KEY.
+// }}}
+
+//History of observations {{{
+static History history;
+static int history_unsaved = 0;                 // Observations appended since the history was last saved.
+// }}}
+
+static Counters counters;
+
+//Latency tracing {{{
+static uint32_t trace_id = 0;                   // Id of the last traced request, echoed by the phone in its reply.
+static uint32_t trace_sent = 0;                 // When the last traced request was sent, from nowMs().
+static bool trace_pending = false;
+static uint32_t trace_roundtrip = 0;            // Round trip and render times in ms of the last completed trace,
+static uint32_t trace_render = 0;               // reported to the phone with the next request.
 // }}}
 
 //Status {{{
-static bool bt_connected = true;
+static bool bt_connected = true;               // Seeded from bluetooth_connection_service_peek() in init.
 static bool app_connected = false;
+static uint32_t reconnect_delay = RECONNECT_MIN_DELAY;   // Wait before the next init request is considered failed.
 // }}}
 
 //Settings {{{
-static bool setting_bat_save = false;
 static bool setting_largefont = false;
 static bool setting_seconds = true;
 // }}}
@@ -113,23 +224,58 @@ static bool setting_seconds = true;
 
 //Function declarations
 void doScroll(void *);
+void initConnection();
+void requestUpdate();
+
+//Flight categories, as sent in CATEGORY_KEY. Must match the CATEGORY_ values in pebble-js-app.js. {{{
+enum {
+    CATEGORY_VFR = 0,
+    CATEGORY_MVFR = 1,
+    CATEGORY_IFR = 2,
+    CATEGORY_LIFR = 3
+};
 
-//Keys for app message {{{
+static const char *category_names[] = { "VFR", "MVFR", "IFR", "LIFR" };
+// }}}
+
+//Significant weather, as sent in WX_KEY. Must match the WX_ values in pebble-js-app.js. {{{
+enum {
+    WX_PRECIPITATION = 1,
+    WX_FREEZING = 2,
+    WX_THUNDERSTORM = 4,
+    WX_OBSCURATION = 8,
+    WX_HEAVY = 0x10,
+    WX_SEVERE = 0x20
+};
+// }}}
+
+//Hazards, as sent in HAZARD_KEY: the flags of the hazards at the fix in the lowest byte, those of the hazards ahead
+//in the next, and the minutes until the first one ahead in the third. Must match the HAZARD_ values in
+//pebble-js-app.js. {{{
 enum {
-    METAR_KEY = 0x0,
-    REQUEST_KEY = 0x1,
-    STATION_KEY = 0x2,
-    STATUS_KEY = 0x3,
-    INIT_KEY = 0x4,
-    LOCATION_KEY = 0x5,
-    NET_KEY = 0x6,
-    CLOUDS_KEY = 0x7,
-    BAT_KEY = 0x8,
-    LARGEFONT_KEY = 0x9,
-    SECONDS_KEY = 0xa,
-    UPDATED_KEY = 0xb
+    HAZARD_TS = 1,
+    HAZARD_TURB = 2,
+    HAZARD_ICE = 4,
+    HAZARD_IFR = 8,
+    HAZARD_MTN = 0x10,
+    HAZARD_ASH = 0x20,
+    HAZARD_OTHER = 0x40,
+    HAZARD_SIGMET = 0x80            // At least one of the hazards is a SIGMET rather than an AIRMET.
 };
 
+#define HAZARD_KINDS 7
+static const char *hazard_names[HAZARD_KINDS] = { "TS", "TURB", "ICE", "IFR", "MTN", "ASH", "WX" };
+// }}}
+
+//Changes between two reports, as found by diffConditions. {{{
+enum {
+    CHANGE_CATEGORY = 1,
+    CHANGE_CEILING = 2,
+    CHANGE_VISIBILITY = 4,
+    CHANGE_WIND = 8,
+    CHANGE_WEATHER = 0x10,
+    CHANGE_WORSE = 0x80             // At least one of the changes is for the worse.
+};
 // }}}
 
 //Metar text field animation logic {{{
@@ -155,7 +301,7 @@ void scrollTextLayer(int distance) {
        Initiates a scroll of the metar text field by distance pixels. Positive value of distance scrolls the
        text field downwards on screen.
        */
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "A scroll of the weather field by %d has been requested.", distance);
+    // LOG_DEBUG("A scroll of the weather field by %d has been requested.", distance);
     GRect from_frame = layer_get_frame((Layer *)weather_layer);
     GRect to_frame = (GRect) { .origin = { from_frame.origin.x, from_frame.origin.y + distance }, .size = from_frame.size };
 
@@ -164,6 +310,7 @@ void scrollTextLayer(int distance) {
     weather_animation = property_animation_create_layer_frame((Layer *) weather_layer, &from_frame, &to_frame);
     animation_set_curve((Animation *) weather_animation, AnimationCurveEaseInOut);
     animation_set_duration((Animation *) weather_animation, 2000);
+    counters.animation_ms += 2000;
 
     animation_set_handlers((Animation*) weather_animation, (AnimationHandlers) {
                 .started = (AnimationStartedHandler) scroll_animation_started,
@@ -179,7 +326,8 @@ void doScroll(void *data) {
        has been scrolled.
        *data is ignored.
        */
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "A scroll of the weather field has been requested.");
+    counters.timer_fires++;
+    // LOG_DEBUG("A scroll of the weather field has been requested.");
     GRect text_layer_frame = layer_get_frame((Layer *) weather_layer);
 
     //Check if layer has already been scrolled.
@@ -215,7 +363,7 @@ void cancelTimer(Layer *layer) {
     /*
        Cancels a previously set hide timer for the layer, if set.
        */
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Cancelling a timer.");
+    // LOG_DEBUG("Cancelling a timer.");
     for (int i = 0; i < LAYER_TIMERS; i++) {
         if (layer_timers[i].layer) {
             if (layer_timers[i].layer == layer) {
@@ -234,7 +382,7 @@ void setTimer(Layer *layer, uint32_t timeout, AppTimerCallback callback, void *c
        cancelled.
        */
     
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Setting a timer.");
+    // LOG_DEBUG("Setting a timer.");
     cancelTimer(layer);
     
     AppTimer *new_timer = app_timer_register(timeout, callback, callback_data);
@@ -252,7 +400,8 @@ void hideLayer(void *data) {
     /*
        Hides the layer. data will be casted to a layer, which will be hidden.
        */
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Hiding a layer.");
+    // LOG_DEBUG("Hiding a layer.");
+    counters.timer_fires++;
     Layer *layer = (Layer *) data;
     layer_set_hidden(layer, true);
 }
@@ -261,7 +410,7 @@ void hideLayerDelayed(Layer *layer, uint32_t timeout) {
     /*
        Hides the layer in timeout milliseconds.
        */
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Enquiing a hide of a layer.");
+    // LOG_DEBUG("Enquiing a hide of a layer.");
     setTimer(layer, timeout, hideLayer, layer);
 }
 
@@ -269,7 +418,7 @@ void showLayer(Layer *layer) {
     /*
        Shows the layer.
        */
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Showing a layer.");
+    // LOG_DEBUG("Showing a layer.");
     layer_set_hidden(layer, false);
 }
 
@@ -305,6 +454,27 @@ void setMetarFont() {
         textAnimationTimer = app_timer_register(15 * 1000, doScroll, NULL);
     }
 }
+
+static void setMetarText() {
+    /*
+       Shows the metar, or its decoded view, in the metar text field. The decoded view is only rendered, and kept
+       in memory, while it is shown.
+       */
+    if (show_decoded && phrases_length && !decoded) {
+        decoded = malloc(DECODED_SIZE);
+    }
+    if (show_decoded && phrases_length && decoded) {
+        phrases_render(phrases, phrases_length, decoded, DECODED_SIZE);
+        text_layer_set_text(weather_layer, decoded);
+    } else {
+        text_layer_set_text(weather_layer, metar);
+        free(decoded);
+        decoded = NULL;
+    }
+    counters.redraws++;
+    resetScrolling();
+    setMetarFont();
+}
 // }}}
 
 //Dialog box {{{
@@ -313,6 +483,7 @@ void update_dialog_layer_callback(Layer *layer, GContext *ctx) {
     /*
        Callback that is called when the dialog layer needs to be (re)drawn).
        */
+    counters.redraws++;
     graphics_context_set_text_color(ctx, GColorBlack);
     graphics_context_set_fill_color(ctx, GColorWhite);
 
@@ -326,34 +497,393 @@ void update_dialog_layer_callback(Layer *layer, GContext *ctx) {
     graphics_draw_text(ctx, dialog_message, fonts_get_system_font(FONT_KEY_GOTHIC_18), (GRect) { .origin = { 3, 18}, .size = { draw_frame.size.w - 6, draw_frame.size.h } }, GTextOverflowModeWordWrap, GTextAlignmentCenter, NULL);
 }
 
+void renderAlert() {
+    /*
+       Writes the alert title and text for the current flight conditions into the dialog.
+       */
+    static char title[16];
+    snprintf(title, sizeof(title), "%s Alert", category_names[category]);
+    dialog_title = title;
+
+    dialog_message[0] = '\0';
+    if (ceiling > -1) {
+        snprintf(dialog_message, sizeof(dialog_message), "Ceiling %d ft\n", (int) ceiling);
+    }
+    if (visibility > -1) {
+        int used = strlen(dialog_message);
+        snprintf(dialog_message + used, sizeof(dialog_message) - used, "Visibility %d m", (int) visibility);
+    }
+}
+
+static int hazardNames(char *text, size_t size, int32_t flags) {
+    /*
+       Writes the names of the kinds of hazard in flags into text, separated by spaces. Returns the length written.
+       */
+    int used = 0;
+    text[0] = '\0';
+    for (int i = 0; (i < HAZARD_KINDS) && (used < (int) size); i++) {
+        if (flags & (1 << i)) {
+            used += snprintf(text + used, size - used, used ? " %s" : "%s", hazard_names[i]);
+        }
+    }
+    return used < (int) size ? used : (int) size - 1;
+}
+
+void renderHazard() {
+    /*
+       Writes the hazard title and text for the current hazards into the dialog.
+       */
+    int32_t here = hazard & 0xff;
+    int32_t ahead = (hazard >> 8) & 0xff;
+    dialog_title = ((here | ahead) & HAZARD_SIGMET) ? "SIGMET" : "AIRMET";
+
+    dialog_message[0] = '\0';
+    int used = 0;
+    if (here) {
+        used = hazardNames(dialog_message, sizeof(dialog_message), here);
+        used += snprintf(dialog_message + used, sizeof(dialog_message) - used, " here\n");
+    }
+    if (ahead && (used < (int) sizeof(dialog_message) - 1)) {
+        used += hazardNames(dialog_message + used, sizeof(dialog_message) - used, ahead);
+        snprintf(dialog_message + used, sizeof(dialog_message) - used, " in %d min", (int) ((hazard >> 16) & 0xff));
+    }
+}
+
 //TODO Nicer show dialog function.
 // }}}
 
+//Report changes {{{
+
+static Conditions currentConditions() {
+    Conditions c = { category, ceiling, visibility, wind, weather };
+    return c;
+}
+
+static bool significantDelta(int32_t before, int32_t after, int32_t step, int32_t least) {
+    /*
+       Returns true if a value has changed enough to matter: by step, or by both least and a quarter of the smaller
+       value. -1 is unknown, and going from or to unknown is significant.
+       */
+    if (before == after) {
+        return false;
+    }
+    if ((before < 0) || (after < 0)) {
+        return true;
+    }
+    int32_t delta = after > before ? after - before : before - after;
+    int32_t smaller = after < before ? after : before;
+    return (delta >= step) || ((delta >= least) && (delta * 4 >= smaller));
+}
+
+static int diffConditions(const Conditions *before, const Conditions *after) {
+    /*
+       Compares the conditions of two reports, and returns the CHANGE_ flags of what has changed significantly.
+       A ceiling appearing or coming down, visibility or category getting worse, wind picking up or new weather
+       also sets CHANGE_WORSE.
+       */
+    int changes = 0;
+    bool worse = false;
+
+    if (after->category != before->category) {
+        changes |= CHANGE_CATEGORY;
+        worse |= after->category > before->category;
+    }
+    if (significantDelta(before->ceiling, after->ceiling, CEILING_STEP, CEILING_FLOOR)) {
+        changes |= CHANGE_CEILING;
+        worse |= (after->ceiling > -1) && ((before->ceiling < 0) || (after->ceiling < before->ceiling));
+    }
+    if (significantDelta(before->visibility, after->visibility, VISIBILITY_STEP, VISIBILITY_FLOOR)) {
+        changes |= CHANGE_VISIBILITY;
+        worse |= (after->visibility > -1) && (after->visibility < before->visibility);
+    }
+    if (significantDelta(before->wind, after->wind, WIND_STEP, WIND_FLOOR)) {
+        changes |= CHANGE_WIND;
+        worse |= after->wind > before->wind;
+    }
+    if (after->weather != before->weather) {
+        changes |= CHANGE_WEATHER;
+        worse |= (after->weather & ~before->weather) != 0;
+    }
+
+    return worse ? changes | CHANGE_WORSE : changes;
+}
+// }}}
+
+//Performance {{{
+
+void updatePerformance(const Message *message) {
+    /*
+       Recomputes the pressure and density altitude from a metar message, as far as its values have changed, and
+       renders the line shown above the trend.
+       */
+    PerformanceInput input = {
+        .temperature = message_temperature(message, PERFORMANCE_UNKNOWN),
+        .dewpoint = message_dewpoint(message, PERFORMANCE_UNKNOWN),
+        .qnh = message_qnh(message, PERFORMANCE_UNKNOWN),
+        .elevation = message_elevation(message, PERFORMANCE_UNKNOWN)
+    };
+    if (!performance_update(&performance, &performance_input, &input)) {
+        return;
+    }
+
+    performance_text[0] = '\0';
+    if (performance.pressure_altitude != PERFORMANCE_UNKNOWN) {
+        snprintf(performance_text, sizeof(performance_text), "PA %d ", (int) performance.pressure_altitude);
+    }
+    if (performance.density_altitude != PERFORMANCE_UNKNOWN) {
+        int used = strlen(performance_text);
+        snprintf(performance_text + used, sizeof(performance_text) - used, "DA %d ",
+            (int) performance.density_altitude);
+    }
+    if (performance.spread != PERFORMANCE_UNKNOWN) {
+        int used = strlen(performance_text);
+        snprintf(performance_text + used, sizeof(performance_text) - used, "SPR %d", (int) performance.spread);
+    }
+    if (!layer_get_hidden(trend_layer)) {
+        layer_mark_dirty(trend_layer);
+    }
+}
+// }}}
+
+//Runway wind {{{
+
+void updateRunwayWind(const Message *message) {
+    /*
+       Works out the wind on the runway end with the most headwind, when the runways or the wind have changed in a
+       metar message, and renders the line shown above the trend.
+       */
+    Runway received_runways[RUNWAY_MAX];
+    int received_count = 0;
+    int32_t received_variation = 0;
+    memset(received_runways, 0, sizeof(received_runways));     // Padding too, for the memcmp below.
+    uint16_t length;
+    const uint8_t *packed = message_runways(message, &length);
+    if (packed) {
+        received_count = runway_unpack(packed, length, received_runways, RUNWAY_MAX, &received_variation);
+    }
+    int32_t received_direction = message_winddir(message, -1);
+    int32_t received_gust = message_gust(message, -1);
+
+    // The wind speed has already been updated from the message, so a change in it alone always recomputes.
+    static int32_t last_wind = -1;
+    if ((received_count == runway_count) && !memcmp(received_runways, runways, received_count * sizeof(Runway)) &&
+            (received_variation == runway_variation) && (received_direction == wind_direction) && (received_gust == gust) && (wind == last_wind)) {
+        return;
+    }
+    memcpy(runways, received_runways, received_count * sizeof(Runway));
+    runway_count = received_count;
+    runway_variation = received_variation;
+    wind_direction = received_direction;
+    gust = received_gust;
+    last_wind = wind;
+
+    RunwayWind best;
+    runway_text[0] = '\0';
+    if (runway_best(runways, runway_count, runway_variation, wind_direction, wind, gust, &best)) {
+        int32_t crosswind = best.crosswind < 0 ? -best.crosswind : best.crosswind;
+        char side = best.crosswind < 0 ? 'L' : 'R';
+        if (best.gusting) {
+            int32_t gust_crosswind = best.gust_crosswind < 0 ? -best.gust_crosswind : best.gust_crosswind;
+            snprintf(runway_text, sizeof(runway_text), "RWY %s HW %d XW %d-%d%c", best.name, (int) best.headwind,
+                (int) crosswind, (int) gust_crosswind, crosswind || gust_crosswind ? side : ' ');
+        } else {
+            snprintf(runway_text, sizeof(runway_text), "RWY %s HW %d XW %d%c", best.name, (int) best.headwind,
+                (int) crosswind, crosswind ? side : ' ');
+        }
+    }
+    if (!layer_get_hidden(trend_layer)) {
+        layer_mark_dirty(trend_layer);
+    }
+}
+// }}}
+
+//Observation history {{{
+
+static uint8_t packValue(int32_t value, int32_t scale, int32_t cap) {
+    /*
+       Packs a value into a byte for the history. Negative values, i.e. unknown, become 255.
+       */
+    if (value < 0) {
+        return 255;
+    }
+    value /= scale;
+    return value > cap ? cap : value;
+}
+
+void saveHistory() {
+    /*
+       Writes the history to persistent storage, if anything has been added since it was last written.
+       */
+    if (history_unsaved) {
+        persist_write_data(HISTORY_PERSIST_KEY, &history, sizeof(history));
+        history_unsaved = 0;
+    }
+}
+
+void loadHistory() {
+    /*
+       Reads the history from persistent storage. Starts with an empty history if there is none, or if it was saved
+       with another layout.
+       */
+    memset(&history, 0, sizeof(history));
+    if (persist_exists(HISTORY_PERSIST_KEY) && (persist_get_size(HISTORY_PERSIST_KEY) == sizeof(history))) {
+        persist_read_data(HISTORY_PERSIST_KEY, &history, sizeof(history));
+        if ((history.head >= HISTORY_LENGTH) || (history.count > HISTORY_LENGTH)) {
+            memset(&history, 0, sizeof(history));
+        }
+    }
+}
+
+void appendHistory(time_t issued) {
+    /*
+       Adds the current weather to the history. Flash is only written every HISTORY_WRITE_BATCH observations, the
+       rest is saved when the app closes.
+       */
+    Observation *entry = &history.entries[history.head];
+    entry->time = issued;
+    entry->ceiling = packValue(ceiling, 100, 254);
+    entry->visibility = packValue(visibility, 100, 100);
+    entry->wind = packValue(wind, 1, 254);
+    entry->category = category;
+
+    history.head = (history.head + 1) % HISTORY_LENGTH;
+    if (history.count < HISTORY_LENGTH) {
+        history.count++;
+    }
+
+    if (++history_unsaved >= HISTORY_WRITE_BATCH) {
+        saveHistory();
+    }
+}
+
+static int trendValue(const Observation *entry, int row) {
+    /*
+       Returns the value of an observation shown on a row of the trend display, or -1 if it is unknown.
+       */
+    switch (row) {
+        case 0:
+            return entry->ceiling == 255 ? 50 : entry->ceiling;     // No ceiling is drawn as 5000 ft.
+        case 1:
+            return entry->visibility == 255 ? -1 : entry->visibility;
+        default:
+            return entry->wind == 255 ? -1 : entry->wind;
+    }
+}
+
+void update_trend_layer_callback(Layer *layer, GContext *ctx) {
+    /*
+       Draws the pressure and density altitude and the runway wind, and below them a line of the ceiling, visibility and wind for the
+       observations in the history, oldest to the left.
+       */
+    counters.redraws++;
+    static const char *labels[] = { "CIG", "VIS", "WND" };
+    static const int ranges[] = { 50, 100, 40 };     // Full height of each row, in the units of the history.
+    const int row_height = 16;
+    const int graph_x = 30;
+    const int graph_y = 36;
+
+    GRect bounds = layer_get_bounds(layer);
+    int graph_w = bounds.size.w - graph_x - 4;
+
+    graphics_context_set_fill_color(ctx, GColorBlack);
+    graphics_fill_rect(ctx, bounds, 0, GCornerNone);
+    graphics_context_set_text_color(ctx, GColorWhite);
+    graphics_context_set_stroke_color(ctx, GColorWhite);
+
+    graphics_draw_text(ctx, performance_text, fonts_get_system_font(FONT_KEY_GOTHIC_14), (GRect) { .origin = { 2, 0 }, .size = { bounds.size.w - 4, 18 } }, GTextOverflowModeFill, GTextAlignmentLeft, NULL);
+    graphics_draw_text(ctx, runway_text, fonts_get_system_font(FONT_KEY_GOTHIC_14), (GRect) { .origin = { 2, 18 }, .size = { bounds.size.w - 4, 18 } }, GTextOverflowModeFill, GTextAlignmentLeft, NULL);
+
+    for (int row = 0; row < 3; row++) {
+        int top = graph_y + 4 + row * (row_height + 4);
+        graphics_draw_text(ctx, labels[row], fonts_get_system_font(FONT_KEY_GOTHIC_14), (GRect) { .origin = { 2, top }, .size = { graph_x, row_height } }, GTextOverflowModeFill, GTextAlignmentLeft, NULL);
+
+        GPoint previous = GPoint(0, 0);
+        bool has_previous = false;
+        for (int i = 0; i < history.count; i++) {
+            // Oldest observation first.
+            int slot = (history.head + HISTORY_LENGTH - history.count + i) % HISTORY_LENGTH;
+            int value = trendValue(&history.entries[slot], row);
+            if (value < 0) {
+                has_previous = false;
+                continue;
+            }
+            if (value > ranges[row]) {
+                value = ranges[row];
+            }
+            GPoint point = GPoint(graph_x + i * graph_w / (HISTORY_LENGTH - 1), top + row_height - value * row_height / ranges[row]);
+            if (has_previous) {
+                graphics_draw_line(ctx, previous, point);
+            } else {
+                graphics_draw_pixel(ctx, point);
+            }
+            previous = point;
+            has_previous = true;
+        }
+    }
+}
+
+// }}}
+
 //UI Events {{{
 
 void watch_tapped(AccelAxisType axis, int32_t direction) {
     /* 
-       Called when the user taps the watch. Hides the dialog if visible and resets the scrolling.
+       Called when the user taps the watch. Hides the dialog if visible, otherwise shows the weather trend for a
+       while. Another tap while the trend is shown switches the metar text between the report and its decoded view.
+       Resets the scrolling.
        */
-    layer_set_hidden(dialog_layer, true);
+    counters.tap_wakeups++;
+
+    // A tap makes requests matter to the energy budget for a while, so one that it has held back goes out now.
+    schedule_tapped(&schedule, time(NULL));
+    if (schedule_due(&schedule, time(NULL))) {
+        requestUpdate();
+    }
+
+    if (!layer_get_hidden(dialog_layer)) {
+        layer_set_hidden(dialog_layer, true);
+    } else if (!layer_get_hidden(trend_layer) && phrases_length) {
+        layer_set_hidden(trend_layer, true);
+        show_decoded = !show_decoded;
+        setMetarText();
+        return;
+    } else if (history.count || performance_text[0] || runway_text[0]) {
+        layer_mark_dirty(trend_layer);
+        showLayer(trend_layer);
+        hideLayerDelayed(trend_layer, TREND_TIMEOUT);
+    }
     resetScrolling();
 }
 
+void battery_state_changed(BatteryChargeState charge) {
+    /*
+       Called when the battery charge or charging state has changed. The energy budget of the schedule follows it.
+       */
+    schedule_battery(&schedule, time(NULL), charge.charge_percent, charge.is_charging || charge.is_plugged);
+}
+
 void bluetooth_connection_changed(bool connected) {
     /*
        Called whenever the status of the bluetooth connection has changed.
        */
+    counters.bluetooth_wakeups++;
     showStatus();
 
     if (!connected) {
       if (bt_connected) {
         vibes_double_pulse();
       }
-        //vibes_double_pulse();
-        /*if (requestWatch) {
-            app_timer_cancel(requestWatch);
-            requestWatch = NULL;
-        }*/
+        // No point in trying to reach the phone until bluetooth is back. Pushed metars won't arrive either.
+        schedule.push_active = false;
+        if (requestWatchInit) {
+            app_timer_cancel(requestWatchInit);
+            requestWatchInit = NULL;
+        }
+    } else if (!bt_connected) {
+        // Reconnected. Try the phone right away.
+        bt_connected = connected;
+        reconnect_delay = RECONNECT_MIN_DELAY;
+        initConnection();
     }
     bt_connected = connected;
 }
@@ -363,26 +893,109 @@ void bluetooth_connection_changed(bool connected) {
 
 //Request functions {{{
 
+void sendOutbox(DictionaryIterator *iter) {
+    /*
+       Sends the message written to iter, and counts it.
+       */
+    counters.messages_out++;
+    counters.bytes_out += dict_size(iter);
+    app_message_outbox_send();
+}
+
+uint32_t nowMs() {
+    /*
+       Returns a millisecond timestamp for measuring latencies. Wraps around, so only differences are meaningful.
+       */
+    time_t seconds;
+    uint16_t milliseconds;
+    time_ms(&seconds, &milliseconds);
+    return (uint32_t) seconds * 1000 + milliseconds;
+}
+
+void writeTrace(DictionaryIterator *iter) {
+    /*
+       Starts a new trace, and writes its id to a request. The latencies of the previous trace go along.
+       */
+    trace_id++;
+    trace_sent = nowMs();
+    trace_pending = true;
+
+    dict_write_uint32(iter, TRACE_KEY, trace_id);
+    if (trace_roundtrip) {
+        dict_write_uint32(iter, ROUNDTRIP_KEY, trace_roundtrip);
+        dict_write_uint32(iter, RENDER_KEY, trace_render);
+        trace_roundtrip = 0;
+    }
+}
+
+void sendStats() {
+    /*
+       Sends the counters to the phone.
+       */
+    DictionaryIterator *iter;
+    if (app_message_outbox_begin(&iter) != APP_MSG_OK) {
+        return;
+    }
+
+    counters.deferred_minutes = schedule.deferred;
+    Tuplet stats = TupletBytes(STATS_KEY, (const uint8_t *) &counters, sizeof(counters));
+    dict_write_tuplet(iter, &stats);
+    sendOutbox(iter);
+}
+
 void requestFailed(void *data) {
     /*
        Called when the phone did not respond in time to a request.
        */
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Phone did not respond in time!");
+    counters.timer_fires++;
+    LOG_WARNING("Phone did not respond in time!");
 
     app_connected = false;
+    schedule.push_active = false;
     showStatus();
 
-    if (data != NULL) {
+    if ((data != NULL) && bt_connected) {
         void (*callback)(void) = data;
         callback();
     }
 }
 
+void initFailed(void *data) {
+    /*
+       Called when the phone did not respond in time to an init request. Tries again, with a longer wait each time,
+       unless bluetooth is down. Then bluetooth_connection_changed starts over when it comes back.
+       */
+    requestWatchInit = NULL;
+    requestFailed(data);
+}
+
+uint32_t nextReconnectDelay() {
+    /*
+       Returns how long to wait for a reply to the next init request, and doubles the wait for the one after that,
+       up to RECONNECT_MAX_DELAY. Up to half of the wait is added at random, so that retries don't line up.
+       */
+    uint32_t delay = reconnect_delay + rand() % (reconnect_delay / 2);
+    reconnect_delay *= 2;
+    if (reconnect_delay > RECONNECT_MAX_DELAY) {
+        reconnect_delay = RECONNECT_MAX_DELAY;
+    }
+    return delay;
+}
+
+void reconnectTimer(void *data) {
+    /*
+       Timer callback for sending an init request right away.
+       */
+    counters.timer_fires++;
+    initConnection();
+}
+
 void initConnection() {
     /*
        Sends an init request to the phone, to (re)initialize the connection. If the javascript app on the phone is
        running, Pebble will start it. The JS will then respond with init and some settings. If the Pebble app is
-       not running on the found, there will be no response. This function will retry every 5 seconds.
+       not running on the found, there will be no response. This function will retry with an exponential backoff,
+       starting at 5 seconds.
        */
     DictionaryIterator *iter;
     app_message_outbox_begin(&iter);
@@ -395,9 +1008,9 @@ void initConnection() {
         requestWatchInit = NULL;
     }
 
-    requestWatchInit = app_timer_register(5 * 1000, requestFailed, &initConnection);
-    app_message_outbox_send();
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Init request sent.");
+    requestWatchInit = app_timer_register(nextReconnectDelay(), initFailed, &initConnection);
+    sendOutbox(iter);
+    LOG_DEBUG("Init request sent.");
 }
 
 bool confirmConnection() {
@@ -406,7 +1019,8 @@ bool confirmConnection() {
     if (bt_connected) {
         if (app_connected) {
             result = true;
-        } else {
+        } else if (!requestWatchInit) {
+            // Only when no init request is already waiting for its backoff.
             initConnection();
             result = false;
         }
@@ -422,26 +1036,27 @@ void requestLocation() {
        aquired, there will be a 'location': 0 response.
        */
     if (!confirmConnection()) {
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Phone not connected.");
+        LOG_DEBUG("Phone not connected.");
         return;
     }
 
 
-    last_location = time(NULL);
+    schedule_location_sent(&schedule, time(NULL));
 
     DictionaryIterator *iter;
     app_message_outbox_begin(&iter);
     
     Tuplet request = TupletCString(REQUEST_KEY, "location");
     dict_write_tuplet(iter, &request);
+    writeTrace(iter);
 
     if (requestWatchLocation) {
         app_timer_cancel(requestWatchLocation);
         requestWatchLocation = NULL;
     }
     requestWatchLocation = app_timer_register(1 * MINUTES, requestFailed, &initConnection);
-    app_message_outbox_send();
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Location request sent.");
+    sendOutbox(iter);
+    LOG_DEBUG("Location request sent.");
 }
 
 void requestUpdate() {
@@ -449,25 +1064,15 @@ void requestUpdate() {
        Sends a request for updated Metar to the phone.
        */
     if (!confirmConnection()) {
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Phone not connected.");
+        LOG_DEBUG("Phone not connected.");
         return;
     }
     
     //Check if the location has been updated in a while. Otherwise, check that first.
-    time_t seconds_now = time(NULL);
-
-    if (!last_location) {
+    if (schedule_request(&schedule, time(NULL), station != NULL) == SCHEDULE_LOCATION) {
         requestLocation();
         return;
-    } else {
-        int difference = (seconds_now - last_location) / 60;    
-
-        if ((station == NULL) || (difference > LOCATION_INTERVAL)) {
-            requestLocation();
-            return;
-        } 
     }
-    last_weather_check = seconds_now;
 
     DictionaryIterator *iter;
     app_message_outbox_begin(&iter);
@@ -477,89 +1082,86 @@ void requestUpdate() {
 
     Tuplet station_t = TupletCString(STATION_KEY, station);
     dict_write_tuplet(iter, &station_t);
+    writeTrace(iter);
 
     if (requestWatchMetar) {
         app_timer_cancel(requestWatchMetar);
         requestWatchMetar = NULL;
     }
     requestWatchMetar = app_timer_register(1 * MINUTES, requestFailed, &initConnection);
-    app_message_outbox_send();
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Update request sent.");
+    sendOutbox(iter);
+    LOG_DEBUG("Update request sent.");
 }
 
-int calculateInterval() {
+void requestUpdateTimer(void *data) {
     /*
-       Calculate the current interval for Metar requests in minutes.
+       Timer callback for requesting a metar update shortly after a message from the phone.
        */
-    int result = BASE_INTERVAL;
-
-    time_t seconds_now = time(NULL);
-    int time_since_update = (seconds_now - last_weather_update) / 60;
-
-    if (setting_bat_save) {
-        result = BAT_SAVE_INTERVAL;
-    } else {
-        if (initial == 0) {
-            if ((time_since_update > LOW_TRESHOLD) && (time_since_update < HIGH_TRESHOLD)) {
-				// APP_LOG(APP_LOG_LEVEL_DEBUG, "Entering high intensity polling.");
-                result = HIGH_INTERVAL;
-            } else {
-				// APP_LOG(APP_LOG_LEVEL_DEBUG, "Entering low intensity polling.");
-                result = LOW_INTERVAL;
-            }
-        }
-    }
-
-    return result;
+    counters.timer_fires++;
+    requestUpdate();
 }
 
 // }}}
 
 //Handlers {{{
 
+static bool updateText(TextLayer *layer, char *text, size_t size, const char *new_text) {
+    /*
+       Copies new_text into text, the buffer shown by layer, if it differs. Returns whether it did, as only then is
+       the layer marked dirty.
+       */
+    if (strcmp(text, new_text) == 0) {
+        return false;
+    }
+    strncpy(text, new_text, size - 1);
+    text[size - 1] = '\0';
+    text_layer_set_text(layer, text);
+    return true;
+}
+
 static void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
     /*
-       Called every minute. Updates the watch face and requests for location and weather updates when needed.
+       Called every second. Updates the watch face and requests for location and weather updates when needed. A
+       redraw is only counted when some text on it changed, which without seconds shown is once a minute.
        */
+    counters.tick_wakeups++;
     
     time_t seconds_now = p_mktime(tick_time);
   
     //Update watch face.
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Minte tick to handle.");
-    static char time_text[] = "00:00:00";
-    static char date_text[] = "Mon Jan 31 2000";
-  
-    static char metar_age[] = "Issued more than 4 hours ago.";
+    // LOG_DEBUG("Minte tick to handle.");
+    static char time_text[sizeof("00:00:00")] = "";
+    static char date_text[sizeof("Mon Jan 31 2000")] = "";
+    static char metar_age[sizeof("Issued more than 4 hours ago.")] = "";
+    char text[sizeof(metar_age)];
+    bool changed = false;
     
     int age = (int) (seconds_now - metar_update_time) / 60;
     if (age > 240) {
-      snprintf(metar_age, sizeof(metar_age), "Issued more than %d hours ago", 4);
+      snprintf(text, sizeof(text), "Issued more than %d hours ago", 4);
     } else {  
-      snprintf(metar_age, sizeof(metar_age), "Issued %ld minutes ago", (seconds_now - metar_update_time) / 60);
+      snprintf(text, sizeof(text), "Issued %ld minutes ago", (seconds_now - metar_update_time) / 60);
     }
+    changed |= updateText(metar_age_layer, metar_age, sizeof(metar_age), text);
   
     if (setting_seconds) {
-      strftime(time_text, sizeof(time_text), "%H:%M:%S", tick_time);
-      strftime(date_text, sizeof(date_text), "%a %b %d %Y", tick_time);
+      strftime(text, sizeof(time_text), "%H:%M:%S", tick_time);
+      changed |= updateText(clock_layer, time_text, sizeof(time_text), text);
+      strftime(text, sizeof(date_text), "%a %b %d %Y", tick_time);
+      changed |= updateText(date_layer, date_text, sizeof(date_text), text);
     } else {
-      strftime(time_text, sizeof(time_text), "%H:%M", tick_time);
+      strftime(text, sizeof(time_text), "%H:%M", tick_time);
+      changed |= updateText(clock_layer, time_text, sizeof(time_text), text);
+    }
+
+    if (changed) {
+        counters.redraws++;
     }
-  
-    text_layer_set_text(clock_layer, time_text);
-    text_layer_set_text(date_layer, date_text);
-    text_layer_set_text(metar_age_layer, metar_age);
 
     //Request weather update if needed.
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Checking if weather needs to be updated.");
-    int difference = (seconds_now - last_weather_check) / 60;
-    int interval = calculateInterval();
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "%d minutes have passed since last weather check. Current interval is: %d", difference, interval);
-
-    if (difference >= calculateInterval()) { 
-        // APP_LOG(APP_LOG_LEVEL_DEBUG, "%d minutes have passed since last weather check. Requesting update.", 
-        //            difference);
+    // LOG_DEBUG("Checking if weather needs to be updated.");
+    if (schedule_due(&schedule, seconds_now)) { 
         requestUpdate();
-        last_weather_check = seconds_now;
     }
 }
 
@@ -568,8 +1170,9 @@ void out_sent_handler(DictionaryIterator *sent, void *context) {
     /* 
        Called when a message was delievered to phone.
        */
+    counters.outbox_wakeups++;
 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Update request delievered.");
+    LOG_DEBUG("Update request delievered.");
 }
 
 void out_failed_handler(DictionaryIterator *failed, AppMessageResult reason, void *context) {
@@ -578,7 +1181,9 @@ void out_failed_handler(DictionaryIterator *failed, AppMessageResult reason, voi
        the phone actually responds. It would be smarter to implement something here, but it would make the code
        a bit more complicated to follow.
        */
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Update request failed.");
+    counters.outbox_wakeups++;
+    counters.outbox_failures++;
+    LOG_WARNING("Update request failed.");
 }
 
 /*void cancelRequestTimer() {
@@ -590,38 +1195,62 @@ void out_failed_handler(DictionaryIterator *failed, AppMessageResult reason, voi
 
 void in_received_handler(DictionaryIterator *received, void *context) {
     /*
-       Called when a message is received from phone. This is the main event driver of the app.
+       Called when a message is received from phone. This is the main event driver of the app. The message is read
+       in one pass, and its keys are then handled in the order they depend on each other.
        */
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Incoming message from phone.");
+    LOG_DEBUG("Incoming message from phone.");
+    uint32_t received_at = nowMs();
+    counters.inbox_wakeups++;
+    counters.messages_in++;
+    counters.bytes_in += dict_size(received);
+
+    Message message;
+    message_read(received, &message);
+    if (message.unknown) {
+        LOG_WARNING("Ignored %d tuples with an unknown key or type.", message.unknown);
+    }
 
+    // Sending an init request doubles the delay, so it is only above twice the minimum once one has gone unanswered.
+    bool backing_off = reconnect_delay > 2 * RECONNECT_MIN_DELAY;
     app_connected = true;
+    reconnect_delay = RECONNECT_MIN_DELAY;
     
     // The INIT key is a response to the init request. This means that the phone is (re)connected.
-    if (dict_find(received, INIT_KEY)) {
+    bool init_received = message_has(&message, INIT_KEY);
+    if (!init_received && requestWatchInit && backing_off) {
+        // The phone is evidently back while we were backing off. Initialize again right away. A first init request
+        // is left to be answered, whatever else arrives meanwhile.
+        app_timer_cancel(requestWatchInit);
+        requestWatchInit = NULL;
+        app_timer_register(100, reconnectTimer, NULL);
+    }
+    if (init_received) {
         if (requestWatchInit) {
             app_timer_cancel(requestWatchInit);
             requestWatchInit = NULL;
         }
-        initial = 2;
-        app_timer_register(100, requestUpdate, NULL);
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Initialized.");
+        schedule_reset(&schedule);
+        app_timer_register(100, requestUpdateTimer, NULL);
+        LOG_DEBUG("Initialized.");
     }
 
     // Check if there are any new settings.
-    Tuple *largefont_tuple = dict_find(received, LARGEFONT_KEY);
-    if (largefont_tuple) {
-        setting_largefont = largefont_tuple->value->uint8 != 0;
+    if (message_has(&message, LARGEFONT_KEY)) {
+        setting_largefont = message_largefont(&message, 0) != 0;
         setMetarFont();
     }    
 
-    Tuple *battery_tuple = dict_find(received, BAT_KEY);
-    if (battery_tuple) {
-        setting_bat_save = battery_tuple->value->uint8 != 0;
+    // While the phone pushes new metars, polling is only a fallback.
+    if (message_has(&message, PUSH_KEY)) {
+        schedule.push_active = message_push(&message, 0) != 0;
+    }
+
+    if (message_has(&message, BAT_KEY)) {
+        schedule.bat_save = message_bat(&message, 0) != 0;
     }
   
-    Tuple *seconds_tuple = dict_find(received, SECONDS_KEY);
-    if (seconds_tuple) {
-      setting_seconds = seconds_tuple->value->uint8 != 0;
+    if (message_has(&message, SECONDS_KEY)) {
+      setting_seconds = message_seconds(&message, 0) != 0;
       if (setting_seconds) {
         text_layer_set_font(clock_layer, fonts_get_system_font(FONT_KEY_BITHAM_34_MEDIUM_NUMBERS));
         layer_set_hidden(text_layer_get_layer(date_layer), false);
@@ -636,9 +1265,8 @@ void in_received_handler(DictionaryIterator *received, void *context) {
     // name.
     // A LOCATION_KEY = -1 indicates that the the search has failed. Request update. If we have a station name
     // from before, this will succeed.
-    Tuple *location_tuple = dict_find(received, LOCATION_KEY);
-    if (location_tuple) {
-        int gps_value = location_tuple->value->uint8;
+    if (message_has(&message, LOCATION_KEY)) {
+        int gps_value = message_location(&message, 0);
         if (gps_value == 1) {
             showLayer((Layer *) gps_icon_layer);
         } else {
@@ -649,9 +1277,8 @@ void in_received_handler(DictionaryIterator *received, void *context) {
         }
     }
 
-    Tuple *net_tuple = dict_find(received, NET_KEY);
-    if (net_tuple) {
-        int net_value = net_tuple->value->uint8;
+    if (message_has(&message, NET_KEY)) {
+        int net_value = message_net(&message, 0);
         if (net_value == 1) {
             showLayer((Layer *) net_icon_layer);
         } else {
@@ -662,88 +1289,136 @@ void in_received_handler(DictionaryIterator *received, void *context) {
     // Check if we have received a weather update.
   
     // Is a new issued time sent?
-    Tuple *updated_tuple = dict_find(received, UPDATED_KEY);
-    if (updated_tuple) {
-      APP_LOG(APP_LOG_LEVEL_DEBUG, "Metar was issued %d seconds ago.", (int) (time(NULL) - updated_tuple->value->uint32));
-      //metar_update_time = time(NULL) - updated_tuple->value->uint32;
-      metar_update_time = updated_tuple->value->uint32;
+    if (message_has(&message, UPDATED_KEY)) {
+      uint32_t updated = message_updated(&message, 0);
+      LOG_DEBUG("Metar was issued %d seconds ago.", (int) (time(NULL) - updated));
+      //metar_update_time = time(NULL) - updated;
+      metar_update_time = updated;
     }
   
-    bool imc_before = imc;
     bool metar_changed = false;
+    Conditions conditions_before = currentConditions();
 
-    Tuple *metar_tuple = dict_find(received, METAR_KEY);
-    if (metar_tuple) {
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Metar recieved: %s", metar_tuple->value->cstring);
+    const char *received_metar = message_metar(&message);
+    if (received_metar) {
+        LOG_DEBUG("Metar recieved: %s", received_metar);
         if (requestWatchMetar) {
             app_timer_cancel(requestWatchMetar);
             requestWatchMetar = NULL;
         }
 
-        imc = false;
-
-        // Check if we have changed.
-        if ((!metar) || (strncmp(metar_tuple->value->cstring, metar, 12) != 0)) {
-            metar_changed = true;
+        // A new report has a new station or issue time. Corrections keep the issue time, but change the text.
+        metar_changed = (!metar) || (strncmp(received_metar, metar, 12) != 0);
 
+        // Only lay the text out again if it has changed. The phrases come with the text, and change with it.
+        if ((!metar) || (strcmp(received_metar, metar) != 0)) {
             free(metar);
-            metar = malloc(strlen(metar_tuple->value->cstring) + 1);
-            metar = strcpy(metar, metar_tuple->value->cstring);
-
-            last_weather_update = time(NULL);
-            text_layer_set_text(weather_layer, metar);
-            resetScrolling();
-            setMetarFont();
-            
-            //light_enable_interaction();
-            if (initial > 0) {
-                initial--;
+            metar = malloc(strlen(received_metar) + 1);
+            metar = strcpy(metar, received_metar);
+
+            uint16_t length;
+            const uint8_t *received_phrases = message_phrases(&message, &length);
+            free(phrases);
+            phrases = NULL;
+            phrases_length = 0;
+            if (received_phrases && (phrases = malloc(length))) {
+                memcpy(phrases, received_phrases, length);
+                phrases_length = length;
             }
-            // APP_LOG(APP_LOG_LEVEL_DEBUG, "Metar is different from old, initial is now %d", initial);
- 
-        } else {
-            // APP_LOG(APP_LOG_LEVEL_DEBUG, "Metar unchanged");
+
+            setMetarText();
+        }
+
+        if (metar_changed) {
+            schedule_metar_received(&schedule, time(NULL));
+            //light_enable_interaction();
         }
     }
   
-    // Check if we have received clouds, which is an imc alert.
-    Tuple *clouds_tuple = dict_find(received, CLOUDS_KEY);
-    if (clouds_tuple) {
-        free(dialog_message);
-        dialog_message = malloc(strlen(clouds_tuple->value->cstring) + 1);
-        dialog_message = strcpy(dialog_message, clouds_tuple->value->cstring);
-        dialog_title = "IMC Alert";
-        if (metar_changed) {
-            showLayer(dialog_layer);
-            hideLayerDelayed(dialog_layer, 1 * MINUTES);
+    // Check the flight category of the weather. IFR or worse is an imc alert.
+    if (message_has(&message, CATEGORY_KEY)) {
+        category = message_category(&message, CATEGORY_VFR);
+        if (category > CATEGORY_LIFR) {
+            category = CATEGORY_LIFR;
         }
+        ceiling = message_ceiling(&message, -1);
+        visibility = message_visibility(&message, -1);
+        wind = message_wind(&message, -1);
+        weather = message_wx(&message, 0);
+        schedule.marginal = category != CATEGORY_VFR;
+
+        updatePerformance(&message);
+        updateRunwayWind(&message);
+
+        // Alert only on changes that matter, and only vibrate when they are for the worse.
+        Conditions conditions_after = currentConditions();
+        int changes = diffConditions(&conditions_before, &conditions_after);
+        imc = category >= CATEGORY_IFR;
+        if (imc) {
+            renderAlert();
+            if (changes) {
+                counters.alerts++;
+                showLayer(dialog_layer);
+                hideLayerDelayed(dialog_layer, 1 * MINUTES);
+            }
+            if (changes & CHANGE_WORSE) {
+                counters.vibrations++;
+                vibes_short_pulse();
+            }
+        }
+    }
 
-        if (!imc_before) {
+    // Alert on hazards that were not there before, here or ahead, but not on ones that have been left behind.
+    if (message_has(&message, HAZARD_KEY)) {
+        int32_t hazard_before = hazard;
+        hazard = message_hazard(&message, 0);
+        if ((hazard & ~hazard_before) & 0xffff) {
+            renderHazard();
+            counters.alerts++;
+            counters.vibrations++;
+            showLayer(dialog_layer);
+            hideLayerDelayed(dialog_layer, 1 * MINUTES);
             vibes_short_pulse();
         }
-        imc = true;
     }
 
-    Tuple *station_tuple = dict_find(received, STATION_KEY);
-    if (station_tuple) {
+    // A new metar goes into the history, along with its conditions.
+    if (metar_changed) {
+        appendHistory(metar_update_time);
+    }
+
+    const char *received_station = message_station(&message);
+    if (received_station) {
         if (requestWatchLocation) {
             app_timer_cancel(requestWatchLocation);
             requestWatchLocation = NULL;
         }
-        if ((!station) || (strncmp(station_tuple->value->cstring, station, 12) != 0)) {
+        if ((!station) || (strncmp(received_station, station, 12) != 0)) {
             if (station) {
-                APP_LOG(APP_LOG_LEVEL_DEBUG, "Freeing station memory.");
+                LOG_DEBUG("Freeing station memory.");
                 free(station);
             }
-            APP_LOG(APP_LOG_LEVEL_DEBUG, "Allocating %d memory for station.", strlen(station_tuple->value->cstring));
-            station = malloc(strlen(station_tuple->value->cstring) + 1);
-            APP_LOG(APP_LOG_LEVEL_DEBUG, "Setting station to %s.", station);
-            station = strcpy(station, station_tuple->value->cstring);
+            LOG_DEBUG("Allocating %d memory for station.", (int) strlen(received_station));
+            station = malloc(strlen(received_station) + 1);
+            station = strcpy(station, received_station);
 
-            APP_LOG(APP_LOG_LEVEL_DEBUG, "Station set to: %s", station);
-            initial = 2;
+            LOG_DEBUG("Station set to: %s", station);
+            schedule_station_changed(&schedule);
         }
-        app_timer_register(100, requestUpdate, NULL);
+        app_timer_register(100, requestUpdateTimer, NULL);
+    }
+
+    // A reply to the pending traced request completes the trace.
+    if (message_has(&message, TRACE_KEY) && trace_pending && (message_trace(&message, 0) == trace_id)) {
+        trace_pending = false;
+        trace_roundtrip = received_at - trace_sent;
+        trace_render = nowMs() - received_at;
+        LOG_INFO("Trace %u: %u ms round trip, %u ms render.", (unsigned) trace_id, (unsigned) trace_roundtrip, (unsigned) trace_render);
+    }
+
+    // The phone asks for the counters with a STATS_KEY.
+    if (message_has(&message, STATS_KEY)) {
+        sendStats();
     }
 
     showStatus();
@@ -754,7 +1429,9 @@ void in_dropped_handler(AppMessageResult reason, void *context) {
        Called when an incoming message was dropped, e.g. when it's to large for the watch to handle or when the 
        watch is otherwise busy.
        */
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Incoming message dropped!");
+    LOG_WARNING("Incoming message dropped!");
+    counters.inbox_wakeups++;
+    counters.inbox_dropped++;
 }
 
 // }}}
@@ -866,6 +1543,11 @@ static void window_load(Window *window) {
     layer_set_update_proc(dialog_layer, update_dialog_layer_callback);
     layer_add_child(window_layer, dialog_layer);
 
+    trend_layer = layer_create((GRect) { .origin = { 0, 62 }, .size = { bounds.size.w, 96 } });
+    layer_set_hidden(trend_layer, true);
+    layer_set_update_proc(trend_layer, update_trend_layer_callback);
+    layer_add_child(window_layer, trend_layer);
+
     if (persist_exists(STATION_KEY)) {
         station = malloc(10);
         persist_read_string(STATION_KEY, station, 10);
@@ -877,7 +1559,10 @@ static void window_load(Window *window) {
     struct tm *current_time = localtime(&now);
     handle_minute_tick(current_time, MINUTE_UNIT);
     showStatus();
-    initConnection();
+    if (bt_connected) {
+        // Otherwise bluetooth_connection_changed sends it when bluetooth comes up.
+        initConnection();
+    }
 }
 
 static void window_unload(Window *window) {
@@ -887,9 +1572,10 @@ static void window_unload(Window *window) {
        memory.
      */
 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Storing metar '%s'.", metar);
+    LOG_DEBUG("Storing metar '%s'.", metar);
     persist_write_string(METAR_KEY, metar);
     persist_write_string(STATION_KEY, station);
+    saveHistory();
 
     text_layer_destroy(weather_layer);
     text_layer_destroy(clock_layer);
@@ -909,23 +1595,22 @@ static void window_unload(Window *window) {
 
     layer_destroy(status_layer);
     layer_destroy(dialog_layer);
+    layer_destroy(trend_layer);
     layer_destroy(weather_layer_frame);
 
     property_animation_destroy(weather_animation);
 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Freeing Metar.");
+    LOG_DEBUG("Freeing Metar.");
     if (metar) 
         free(metar);
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Freeing station.");
+    free(phrases);
+    free(decoded);
+    LOG_DEBUG("Freeing station.");
     if (station)
         free(station);
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Freeing dialog.");
-    if (dialog_message) {
-      free(dialog_message);
-    }
-    //APP_LOG(APP_LOG_LEVEL_DEBUG, "Freeing dialog title.");
+    //LOG_DEBUG("Freeing dialog title.");
     //free(dialog_title);
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "Freeing layer timers.");
+    LOG_DEBUG("Freeing layer timers.");
     free(layer_timers);
 }
 // }}}
@@ -944,7 +1629,10 @@ static void init() {
         .unload = window_unload,
     });
 
-    last_weather_check = time(NULL);
+    schedule_init(&schedule, &schedule_default_policy, time(NULL));
+    battery_state_changed(battery_state_service_peek());
+    bt_connected = bluetooth_connection_service_peek();
+    srand(time(NULL));
 
     app_message_register_inbox_received(in_received_handler);
     app_message_register_inbox_dropped(in_dropped_handler);
@@ -955,25 +1643,27 @@ static void init() {
 
     bluetooth_connection_service_subscribe(bluetooth_connection_changed);
     accel_tap_service_subscribe(&watch_tapped);
+    battery_state_service_subscribe(battery_state_changed);
 
     const uint32_t inbound_size = app_message_inbox_size_maximum();
-    // APP_LOG(APP_LOG_LEVEL_DEBUG, "Setting inbox to size %d", (int) inbound_size);
+    // LOG_DEBUG("Setting inbox to size %d", (int) inbound_size);
     const uint32_t outbound_size = 128;
     app_message_open(inbound_size, outbound_size);
 
-    dialog_message = malloc(50);
     if (persist_exists(METAR_KEY)) {
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "Found stored metar!");
+        LOG_DEBUG("Found stored metar!");
         int metar_length = persist_get_size(METAR_KEY);
         metar = malloc(metar_length);
         persist_read_string(METAR_KEY, metar, metar_length);
     } else {
-        APP_LOG(APP_LOG_LEVEL_DEBUG, "No stored metar was found.");
+        LOG_DEBUG("No stored metar was found.");
         metar = malloc(200);
     }
 
     layer_timers = malloc(LAYER_TIMERS * sizeof(LayerTimer));
 
+    loadHistory();
+
     const bool animated = true;
 //#ifdef PBL_PLATFORM_APLITE
 //    window_set_fullscreen(window, true);
@@ -988,6 +1678,7 @@ static void deinit() {
     window_destroy(window);
   
     accel_tap_service_unsubscribe();
+    battery_state_service_unsubscribe();
 }
 
 int main() {
@@ -3,105 +3,117 @@
 // http://en.wikipedia.org/wiki/METAR
 // http://www.unc.edu/~haines/metar.html
 
-var CLOUDS = {
-    NCD: "no clouds",
-    SKC: "sky clear",
-    CLR: "no clouds under 12,000 ft",
-    NSC: "no significant",
-    FEW: "few",
-    SCT: "scattered",
-    BKN: "broken",
-    OVC: "overcast",
-    VV: "vertical visibility"
-};
+//CLOUDS and WEATHER map the abbreviations of cloud and weather groups to what they mean. They are generated at build
+//time by tools/phrases.py from the CLOUDS: and WX: phrases of resources/data/phrases.json, and added before this
+//file, so the parser only knows the abbreviations the decoded view has phrases for.
+
+function buildAbbreviationIndex(map) {
+//Builds a lookup table for an abbreviation map, keyed on the char code of the first letter. Each slot holds the
+//abbreviations starting with that letter, longest first, so the first hit is the longest match.
+    var index = [];
+    Object.keys(map).forEach(function(abbreviation) {
+        var code = abbreviation.charCodeAt(0);
+        index[code] = index[code] || [];
+        index[code].push({
+            abbreviation: abbreviation,
+            meaning: map[abbreviation]
+        });
+    });
+    index.forEach(function(slot) {
+        slot.sort(function(a, b) {
+            return b.abbreviation.length - a.abbreviation.length;
+        });
+    });
+    return index;
+}
 
+var CLOUDS_INDEX = buildAbbreviationIndex(CLOUDS);
+var WEATHER_INDEX = buildAbbreviationIndex(WEATHER);
+
+function matchAbbreviation(s, offset, index) {
+//Returns the longest entry of index that s contains at offset, without slicing s.
+    if (!s || offset >= s.length) return;
+    var slot = index[s.charCodeAt(offset)];
+    if (!slot) return;
+    for (var i = 0; i < slot.length; i++) {
+        var abbreviation = slot[i].abbreviation;
+        var length = abbreviation.length;
+        if (offset + length > s.length) continue;
+        var j = 1;
+        while ((j < length) && (s.charCodeAt(offset + j) === abbreviation.charCodeAt(j))) j++;
+        if (j === length) return slot[i];
+    }
+}
 
-var WEATHER = {
-    // Intensity
-    "-": "light intensity",
-    "+": "heavy intensity",
-    VC: "in the vicinity",
-
-    // Descriptor
-    MI: "shallow",
-    PR: "partial",
-    BC: "patches",
-    DR: "low drifting",
-    BL: "blowing",
-    SH: "showers",
-    TS: "thunderstorm",
-    FZ: "freezing",
-
-    // Precipitation
-    RA: "rain",
-    DZ: "drizzle",
-    SN: "snow",
-    SG: "snow grains",
-    IC: "ice crystals",
-    PL: "ice pellets",
-    GR: "hail",
-    GS: "small hail",
-    UP: "unknown precipitation",
-
-    // Obscuration
-    FG: "fog",
-    VA: "volcanic ash",
-    BR: "mist",
-    HZ: "haze",
-    DU: "widespread dust",
-    FU: "smoke",
-    SA: "sand",
-    PY: "spray",
-
-    // Other
-    SQ: "squall",
-    PO: "dust or sand whirls",
-    DS: "duststorm",
-    SS: "sandstorm",
-    FC: "funnel cloud"
-};
+function asInt(s) {
+    return parseInt(s, 10);
+}
 
-function parseAbbreviation(s, map) {
-    var abbreviation, meaning, length = 3;
-    if (!s) return;
-    while (length && !meaning) {
-        abbreviation = s.slice(0, length);
-        meaning = map[abbreviation];
-        length--;
+function intAt(s, start, end) {
+//Same as asInt(s.slice(start, end)) for a whitespace free s, but without creating the substring.
+    var sign = 1, value = 0, digits = 0, c;
+    if (end > s.length) end = s.length;
+    if (start < end) {
+        c = s.charCodeAt(start);
+        if (c === 45 || c === 43) {
+            //'-' or '+'
+            if (c === 45) sign = -1;
+            start++;
+        }
     }
-    if (meaning) {
-        return {
-            abbreviation: abbreviation,
-            meaning: meaning
-        };
+    while (start < end) {
+        c = s.charCodeAt(start) - 48;
+        if (c < 0 || c > 9) break;
+        value = value * 10 + c;
+        digits++;
+        start++;
     }
+    return digits ? sign * value : NaN;
 }
 
-function asInt(s) {
-    return parseInt(s, 10);
+function isDigitAt(s, i) {
+    var c = s.charCodeAt(i);
+    return c >= 48 && c <= 57;
+}
+
+function endsWith(s, suffix) {
+    return s.length >= suffix.length && s.indexOf(suffix, s.length - suffix.length) !== -1;
 }
 
 
 
 function METAR(metarString) {
-    this.fields = metarString.split(" ").map(function(f) {
-        return f.trim();
-    }).filter(function(f) {
-        return !!f;
-    });
-    this.i = -1;
+//The METAR is scanned one token at a time straight from the string, instead of being split up front.
+    this.text = metarString;
+    this.position = 0;
+    this.peeked = null;
     this.current = null;
     this.result = {};
 }
 
+METAR.prototype.scan = function() {
+//Returns the next whitespace separated token from the string, or undefined at the end.
+    var s = this.text, length = s.length, p = this.position, start;
+    while ((p < length) && (s.charCodeAt(p) <= 32)) p++;
+    start = p;
+    while ((p < length) && (s.charCodeAt(p) > 32)) p++;
+    this.position = p;
+    if (start < p) return s.slice(start, p);
+};
+
 METAR.prototype.next = function() {
-    this.i++;
-    this.current = this.fields[this.i];
+    if (this.peeked !== null) {
+        this.current = this.peeked;
+        this.peeked = null;
+    } else {
+        this.current = this.scan();
+    }
     return this.current;
 };
 
 METAR.prototype.peek = function() {
-    return this.fields[this.i+1];
+    if (this.peeked === null) this.peeked = this.scan();
+    return this.peeked;
 };
 
 METAR.prototype.parseStation = function() {
@@ -112,9 +124,9 @@ METAR.prototype.parseStation = function() {
 METAR.prototype.parseDate = function() {
     this.next();
     var d = new Date();
-    d.setUTCDate(asInt(this.current.slice(0,2)));
-    d.setUTCHours(asInt(this.current.slice(2,4)));
-    d.setUTCMinutes(asInt(this.current.slice(4,6)));
+    d.setUTCDate(intAt(this.current, 0, 2));
+    d.setUTCHours(intAt(this.current, 2, 4));
+    d.setUTCMinutes(intAt(this.current, 4, 6));
     d.setUTCSeconds(0);
     this.result.time = d;
 };
@@ -124,9 +136,36 @@ METAR.prototype.parseAuto = function() {
     if (this.result.auto) this.next();
 };
 
-var variableWind = /^([0-9]{3})V([0-9]{3})$/;
+function windUnit(s) {
+//Returns the unit of a wind group, i.e. whichever of KT, MPS or a trailing KPH comes first.
+    var unit, position = -1;
+    var kt = s.indexOf("KT");
+    var mps = s.indexOf("MPS");
+    var kph = endsWith(s, "KPH") ? s.length - 3 : -1;
+    if (kt !== -1) {
+        unit = "KT";
+        position = kt;
+    }
+    if ((mps !== -1) && ((position === -1) || (mps < position))) {
+        unit = "MPS";
+        position = mps;
+    }
+    if ((kph !== -1) && ((position === -1) || (kph < position))) {
+        unit = "KPH";
+    }
+    return unit;
+}
+
+function isVariableWind(s) {
+//True for a variable wind direction group, i.e. '180V240'.
+    return (s !== undefined) && (s.length === 7) && (s.charCodeAt(3) === 86) &&
+        isDigitAt(s, 0) && isDigitAt(s, 1) && isDigitAt(s, 2) &&
+        isDigitAt(s, 4) && isDigitAt(s, 5) && isDigitAt(s, 6);
+}
+
 METAR.prototype.parseWind = function() {
     this.next();
+    var s = this.current || "";
     this.result.wind = {
         speed: null,
         gust: null,
@@ -134,36 +173,36 @@ METAR.prototype.parseWind = function() {
         variation: null
     };
 
-    var direction = this.current.slice(0,3);
-    if (direction === "VRB") {
+    if (s.charCodeAt(0) === 86 && s.charCodeAt(1) === 82 && s.charCodeAt(2) === 66) {
+        //'VRB'
         this.result.wind.direction = "VRB";
         this.result.wind.variation = true;
     }
     else {
-        this.result.wind.direction = asInt(direction);
+        this.result.wind.direction = intAt(s, 0, 3);
     }
 
-    var gust = this.current.slice(5,8);
-    if (gust[0] === "G") {
-        this.result.wind.gust = asInt(gust.slice(1));
+    if (s.charCodeAt(5) === 71) {
+        //'G'
+        this.result.wind.gust = intAt(s, 6, 8);
     }
 
-    this.result.wind.speed = asInt(this.current.slice(3,5));
+    this.result.wind.speed = intAt(s, 3, 5);
 
-    var unitMatch = this.current.match(/KT|MPS|KPH$/);
-    if (unitMatch) {
-        this.result.wind.unit = unitMatch[0];
+    var unit = windUnit(s);
+    if (unit) {
+        this.result.wind.unit = unit;
     }
     else {
-        throw new Error("Bad wind unit: " + this.current);
+        throw new Error("Bad wind unit: " + s);
     }
 
-    var varMatch = this.peek().match(variableWind);
-    if (varMatch) {
+    var variation = this.peek();
+    if (isVariableWind(variation)) {
         this.next();
         this.result.wind.variation = {
-            min: asInt(varMatch[1]),
-            max: asInt(varMatch[2])
+            min: intAt(variation, 0, 3),
+            max: intAt(variation, 4, 7)
         };
     }
 };
@@ -174,27 +213,39 @@ METAR.prototype.parseCavok = function() {
     if (this.result.cavok) this.next();
 };
 
+function metricVisibility(s) {
+//Returns the first run of four digits in s as a number, or -1 if there is none.
+    if (!s) return -1;
+    var run = 0;
+    for (var i = 0; i < s.length; i++) {
+        run = isDigitAt(s, i) ? run + 1 : 0;
+        if (run === 4) return intAt(s, i - 3, i + 1);
+    }
+    return -1;
+}
+
 METAR.prototype.parseVisibility = function() {
     this.result.visibility = null;
     this.result.statuevisibility = null;
     if (this.result.cavok) return;
     this.next();
-    if (this.current === "////") return;
+    if ((this.current === undefined) || (this.current === "////")) return;
 
-    var metricvis = /\d{4}/.exec(this.current);
-    if (metricvis) {
+    var metricvis = metricVisibility(this.current);
+    if (metricvis !== -1) {
         //Visibility in meters
-        this.result.visibility = asInt(metricvis);
+        this.result.visibility = metricvis;
         return;
     }
 
     var meters = 0;
-    if (this.current.match(/SM/)) {
+    var following = this.peek();
+    if (this.current.indexOf("SM") !== -1) {
         //1 word statue mile number, i.e. '2SM'
         this.result.statuevisibility = this.current;
-    } else if (this.peek().match(/SM/)) {
+    } else if ((following !== undefined) && (following.indexOf("SM") !== -1)) {
         //2 word statue mile number, i.e. '1 1/2SM'
-        this.result.statuevisibility = this.current + ' ' + this.peek();
+        this.result.statuevisibility = this.current + ' ' + following;
         meters += asInt(this.current) * 1609;
         this.next();
     } else {
@@ -205,11 +256,11 @@ METAR.prototype.parseVisibility = function() {
     var divplace = this.current.indexOf("/");
     if (divplace != -1) {
         //Fraction
-        var nom = asInt(this.current.slice(0,divplace));
-        var den = asInt(this.current.slice(divplace + 1, smplace));
+        var nom = intAt(this.current, 0, divplace);
+        var den = intAt(this.current, divplace + 1, smplace);
         meters += nom * 1609 / den;
     } else {
-        meters += asInt(this.current.slice(0,smplace)) * 1609;
+        meters += intAt(this.current, 0, smplace) * 1609;
     }
 
     this.result.visibility = meters;
@@ -218,7 +269,9 @@ METAR.prototype.parseVisibility = function() {
 
 METAR.prototype.parseRunwayVisibility = function() {
     if (this.result.cavok) return;
-    while (this.peek().match(/^R[0-9]+/)) {
+    var s;
+    while ((s = this.peek()) && (s.charCodeAt(0) === 82) && isDigitAt(s, 1)) {
+        //'R' followed by a runway number
         this.next();
         // TODO: Parse it. I've not seen it in finnish METARs...
     }
@@ -226,12 +279,13 @@ METAR.prototype.parseRunwayVisibility = function() {
 
 
 
-function parseWeatherAbbrv(s, res) {
-    var weather = parseAbbreviation(s, WEATHER);
-    if (weather) {
+function parseWeatherAbbrv(s) {
+//Splits a weather group, i.e. '-SHRA', into its abbreviations. Returns undefined if s is not a weather group.
+    var res, weather, offset = 0;
+    while ((weather = matchAbbreviation(s, offset, WEATHER_INDEX))) {
         res = res || [];
         res.push(weather);
-        return parseWeatherAbbrv(s.slice(weather.abbreviation.length), res);
+        offset += weather.abbreviation.length;
     }
     return res;
 }
@@ -249,20 +303,92 @@ METAR.prototype.parseWeather = function() {
 
 
 METAR.prototype.parseClouds = function() {
-    if (!this.result.clouds) this.result.clouds = null;
+    var entry, altitude;
+    this.result.clouds = null;
     if (this.result.cavok) return;
-    var cloud = parseAbbreviation(this.peek(), CLOUDS);
-    if (!cloud) return;
+    while ((entry = matchAbbreviation(this.peek(), 0, CLOUDS_INDEX))) {
+        this.next();
 
-    this.next();
+        //000 is a layer at the surface, not a missing height; that is only when there are no digits, e.g. OVC///.
+        altitude = intAt(this.current, entry.abbreviation.length, this.current.length);
+        this.result.clouds = (this.result.clouds || []);
+        this.result.clouds.push({
+            abbreviation: entry.abbreviation,
+            meaning: entry.meaning,
+            altitude: isNaN(altitude) ? null : altitude * 100,
+            cumulonimbus: endsWith(this.current, "CB")
+        });
+    }
+};
 
-    cloud.altitude = asInt(this.current.slice(cloud.abbreviation.length))*100 || null;
-    cloud.cumulonimbus = /CB$/.test(this.current);
+function temperatureAt(s, start, end) {
+//Returns the temperature in s between start and end, i.e. '05' or 'M05' for -5, or NaN if there is none.
+    if (s.charCodeAt(start) === 77) return -intAt(s, start + 1, end) || 0;
+    return intAt(s, start, end);
+}
 
-    this.result.clouds = (this.result.clouds || []);
-    this.result.clouds.push(cloud);
+//Groups that end the body of a report. Temperature and pressure are not looked for past them.
+var END_OF_BODY = { 'RMK': true, 'NOSIG': true, 'TEMPO': true, 'BECMG': true };
 
-    this.parseClouds();
+function isTemperatureGroup(s) {
+    return /^M?\d\d\/(M?\d\d|\/\/)?$/.test(s);
+}
+
+function pressureAt(s) {
+//Returns the QNH in hPa of a pressure group, or NaN if s is not one.
+    if (!s || (s.length !== 5) || !isDigitAt(s, 1)) return NaN;
+    var value = intAt(s, 1, 5);
+    if (s.charCodeAt(0) === 81) return value;
+    if (s.charCodeAt(0) === 65) return value * 0.338639;
+    return NaN;
+}
+
+METAR.prototype.skipTo = function(match) {
+//Skips tokens up to the first one match is true for, and returns it without taking it. Returns undefined at the end
+//of the body. Groups the other parsers left, such as '//' or '//////CB' from automatic stations, are skipped.
+    var s;
+    while ((s = this.peek()) && !END_OF_BODY[s]) {
+        if (match(s)) return s;
+        this.next();
+    }
+};
+
+function isPressureGroup(s) {
+    return !isNaN(pressureAt(s));
+}
+
+function isTemperatureOrPressure(s) {
+    return isTemperatureGroup(s) || isPressureGroup(s);
+}
+
+METAR.prototype.parseTemperature = function() {
+//Temperature and dew point, i.e. '10/05' or 'M02/M04'. The dew point may be missing, as in '10/' or '10///'.
+    this.result.temperature = null;
+    this.result.dewpoint = null;
+    var s = this.peek();
+    if (!s || !isTemperatureGroup(s)) {
+        //Not past the pressure, in case the temperature is missing.
+        s = this.skipTo(isTemperatureOrPressure);
+        if (!s || !isTemperatureGroup(s)) return;
+    }
+    this.next();
+    var slash = s.indexOf("/");
+    this.result.temperature = temperatureAt(s, 0, slash);
+    var dewpoint = temperatureAt(s, slash + 1, s.length);
+    if (!isNaN(dewpoint)) this.result.dewpoint = dewpoint;
+};
+
+METAR.prototype.parsePressure = function() {
+//QNH in hPa, from 'Q1013', or from 'A2992' in hundredths of inches of mercury.
+    this.result.qnh = null;
+    var qnh = pressureAt(this.peek());
+    if (isNaN(qnh)) {
+        var s = this.skipTo(isPressureGroup);
+        if (!s) return;
+        qnh = pressureAt(s);
+    }
+    this.result.qnh = qnh;
+    this.next();
 };
 
 METAR.prototype.parse = function() {
@@ -275,6 +401,8 @@ METAR.prototype.parse = function() {
     this.parseRunwayVisibility();
     this.parseWeather();
     this.parseClouds();
+    this.parseTemperature();
+    this.parsePressure();
 };
 
 
@@ -331,22 +459,96 @@ function describe(d) {
   return JSON.stringify(d);
 }
 
+//Logging. Messages above logLevel are dropped before they are built: pass a function returning the message rather
+//than the message itself, and it is only called when the message is logged. Nothing but errors is logged unless
+//the configuration has a 'log' level, i.e. 'debug'.
+var LOG_ERROR = 1;
+var LOG_WARNING = 2;
+var LOG_INFO = 3;
+var LOG_DEBUG = 4;
+var LOG_LEVELS = { 'none': 0, 'error': LOG_ERROR, 'warning': LOG_WARNING, 'info': LOG_INFO, 'debug': LOG_DEBUG };
+var logLevel = LOG_ERROR;
+
+function log(level, message) {
+  if (level > logLevel) return;
+  console.log(typeof message === 'function' ? message() : message);
+}
+
+function logError(message) { log(LOG_ERROR, message); }
+function logWarning(message) { log(LOG_WARNING, message); }
+function logInfo(message) { log(LOG_INFO, message); }
+function logDebug(message) { log(LOG_DEBUG, message); }
+
 //Messaging functions. Messages are placed in a send queue by sendMessage, who then calls doSend.
 //If no send is in progress, doSend sends the next message in the send queue. Upon successful delievery
 //doSend is called again, sending the next message in the queue. Upon failed delievery, the failure is logged.
 //doSend is then called again, effectively dropping the failed message. Delievery is thus not guaranteed at this
 //point.
 
+//Latency tracing. The watch sends a 'trace' id with each metar and location request, and the reply that completes
+//the request echoes it. Each stage of the request is timed into a histogram. The watch reports the round trip and
+//its render time of a completed trace with its next request. Histograms count requests in buckets of milliseconds,
+//with the last bucket for anything slower, and are halved when they hold LATENCY_WINDOW requests so that they
+//follow recent behaviour.
+var LATENCY_BOUNDS = [50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000];
+var LATENCY_WINDOW = 200;
+var latency = {};
+
+function recordLatency(stage, ms) {
+//Adds a measurement in milliseconds to the histogram of a stage.
+  var histogram = latency[stage];
+  if (!histogram) {
+    histogram = latency[stage] = { 'counts': [], 'count': 0, 'total': 0, 'max': 0 };
+    for (var i = 0; i <= LATENCY_BOUNDS.length; i++) histogram.counts.push(0);
+  }
+  if (histogram.count >= LATENCY_WINDOW) {
+    histogram.counts = histogram.counts.map(function(c) { return c >> 1; });
+    histogram.total = histogram.total / 2;
+    histogram.count = histogram.counts.reduce(function(a, b) { return a + b; }, 0);
+  }
+  var bucket = 0;
+  while ((bucket < LATENCY_BOUNDS.length) && (ms > LATENCY_BOUNDS[bucket])) bucket++;
+  histogram.counts[bucket]++;
+  histogram.count++;
+  histogram.total += ms;
+  histogram.max = Math.max(histogram.max, ms);
+}
+
+function latencyReport() {
+//Returns the latency histograms, keyed on stage, along with the bucket bounds.
+  return { 'bounds': LATENCY_BOUNDS, 'stages': latency };
+}
+
+function startTrace(payload) {
+//Records the latencies the watch reports, and returns a trace for the request in payload, if it has one.
+  if (payload.roundtrip) {
+    recordLatency('roundtrip', payload.roundtrip);
+    recordLatency('render', payload.render || 0);
+    localStorage.setItem("latency", JSON.stringify(latency));
+  }
+  if (payload.trace === undefined) return null;
+  return { 'id': payload.trace, 'received': Date.now() };
+}
+
+function traced(s, trace) {
+//Adds the id of trace, if any, to the message s.
+  if (trace) s.trace = trace.id;
+  return s;
+}
+
 function sendSuccess(e) {
 //Called upon successful delievery of a message.
-  console.log("Some message claims it was sent: " + JSON.stringify(e));
+  logDebug(function() { return "Some message claims it was sent: " + describe(e); });
+  if (currentMessage && currentMessage.enqueued) {
+    recordLatency('send', Date.now() - currentMessage.enqueued);
+  }
 /*  if ((currentMessage) && (currentMessage.mid == e.data.transactionId)) {
     //console.log("Message with id " + e.data.transactionId + " was sent successfully.");
   } else {
     if (!currentMessage) {
-      console.log("Error! Currentmessage not set!");
+      logError("Error! Currentmessage not set!");
     } else {
-      console.log("Error! Message with id " + e.data.transactionId + " was sent, but id " + currentMessage.mid + " was excpected.");
+      logError("Error! Message with id " + e.data.transactionId + " was sent, but id " + currentMessage.mid + " was excpected.");
     }
   }*/
   currentMessage = null;
@@ -355,7 +557,7 @@ function sendSuccess(e) {
 
 function sendFail(e) {
 //Called upon failed delievery of a message. Message is dropped.
-  console.log("Message: " + JSON.stringify(e) + " failed!");
+  logWarning(function() { return "Message: " + describe(e) + " failed!"; });
   if (currentMessage.retries) {
     currentMessage.retries--;
     messageQueue.push(currentMessage);
@@ -378,132 +580,1125 @@ function doSend() {
   }
 }
 
+//The app message schema. MESSAGE_KEYS and MESSAGE_TYPES are generated at build time by tools/schema.py from the
+//appKeys in appinfo.json, like the header the watch reads its messages with, and added after this file.
+function schemaType(value) {
+//Returns the schema type a value is sent as.
+  if (typeof value == 'string') return 'cstring';
+  if ((typeof value == 'number') || (typeof value == 'boolean')) return 'int';
+  if (Array.isArray(value)) return 'bytes';
+  return typeof value;
+}
+
+function checkMessage(s) {
+//Drops the keys of s that the watch does not know, or would not read because of their type.
+  if (typeof MESSAGE_TYPES === 'undefined') return s;
+  Object.keys(s).forEach(function(key) {
+    var type = MESSAGE_TYPES[key] == 'uint' ? 'int' : MESSAGE_TYPES[key];
+    if (type != schemaType(s[key])) {
+      logError("Dropped '" + key + "' from message: expected " + (type || 'no such key') + ", got " +
+        schemaType(s[key]) + ".");
+      delete s[key];
+    }
+  });
+  return s;
+}
+
 function sendMessage(s) {
 //Places s in the message queue, and calls doSend to commence sending.
-  console.log("Enqueueing message to pebble: " + describe(s));
+  logDebug(function() { return "Enqueueing message to pebble: " + describe(s); });
+  checkMessage(s);
   
   var message = {};
   message.text = s;
   message.retries = MAX_RETRIES;
+  if (s.trace !== undefined) message.enqueued = Date.now();
 
   messageQueue.push(message);
   doSend();
 }
 
-function updateLocation() {
+//Names of the counters the watch sends in 'stats', in the order of the Counters struct in flightweather.c.
+var STATS_FIELDS = [
+  'tick_wakeups', 'inbox_wakeups', 'outbox_wakeups', 'bluetooth_wakeups', 'tap_wakeups',
+  'messages_in', 'messages_out', 'bytes_in', 'bytes_out', 'outbox_failures', 'inbox_dropped',
+  'timer_fires', 'redraws', 'animation_ms', 'alerts', 'vibrations', 'deferred_minutes'
+];
+
+function decodeStats(bytes) {
+//Decodes the little endian uint32 counters the watch sends in 'stats' into an object.
+  var stats = {};
+  STATS_FIELDS.forEach(function(name, i) {
+    var o = i * 4;
+    if (o + 4 <= bytes.length) {
+      stats[name] = (bytes[o] | (bytes[o + 1] << 8) | (bytes[o + 2] << 16)) + bytes[o + 3] * 0x1000000;
+    }
+  });
+  return stats;
+}
+
+function requestStats() {
+//Asks the watch for its counters. They are stored as 'stats' in localStorage when they arrive.
+  sendMessage({'stats': 1});
+}
+
+//Single-flight requests. The watch retries requests that take long to answer, and init and station changes are
+//followed by requests of their own, so identical requests often overlap. Only the first starts a lookup; the others
+//join it while it is in flight, and all of them are answered by its single reply. The reply echoes the trace of the
+//latest request, which is the one the watch waits for. A lookup that has not answered in FLIGHT_EXPIRY is taken to
+//have hung, and is no longer joined, so that later requests start a lookup of their own.
+var FETCH_TIMEOUT = 20 * 1000;          // Per url.
+var FLIGHT_EXPIRY = 90 * 1000;          // Longer than the geolocation timeout and a station lookup together.
+var inFlight = { 'metar': {}, 'location': null };
+var fetchesInFlight = 0;
+
+function startFlight(trace) {
+//Returns a new lookup in flight for a request with trace.
+  return { 'traces': trace ? [trace] : [], 'joined': 0, 'started': Date.now() };
+}
+
+function joinable(flight) {
+//Returns whether flight is in flight and young enough to join.
+  return flight && (Date.now() - flight.started < FLIGHT_EXPIRY);
+}
+
+function joinFlight(flight, trace) {
+//Adds a request with trace to a lookup in flight. The reply is traced with the latest request that has a trace.
+  logDebug("Joining request already in flight.");
+  flight.joined++;
+  if (trace) flight.traces.push(trace);
+}
+
+function landFlight(flight) {
+//Records the phone side latency of every request a lookup answers, and returns the trace to reply with.
+  var now = Date.now();
+  flight.traces.forEach(function(trace) {
+    recordLatency('phone', now - trace.received);
+  });
+  if (flight.joined) logInfo(function() { return "Answered " + (flight.joined + 1) + " requests with one lookup."; });
+  return flight.traces.length ? flight.traces[flight.traces.length - 1] : null;
+}
+
+function updateLocation(trace) {
 //Initiates location progress.
   if (configuration.location) {
+    if (joinable(inFlight.location)) {
+      joinFlight(inFlight.location, trace);
+      return;
+    }
+    var flight = inFlight.location = startFlight(trace);
+    var started = Date.now();
     sendMessage({'location': 1});
-    window.navigator.geolocation.getCurrentPosition(locationSuccess, locationError, {"timeout": 60000, "maximumAge": 15 * 60 * 1000 });
+    window.navigator.geolocation.getCurrentPosition(
+      function(pos) {
+        recordLatency('location', Date.now() - started);
+        locationSuccess(pos, flight);
+      },
+      function(err) {
+        locationError(err, flight);
+      },
+      {"timeout": 60000, "maximumAge": 15 * 60 * 1000 });
   } else {
-    sendMessage({'location': -1, 'station': configuration.station});
+    sendMessage(traced({'location': -1, 'station': configuration.station}, trace));
   }
 }
 
-function fetchWeb(url) {
-  //Accepts either an url as a string or an array of urls. Returns a request for the first url that returns with a 200 code, i.e. success.
-  //If no urls result in a 200 code, the request for the last url is returned. All web requests are done synchronously.
+function fetchWeb(url, callback, quiet, timeout) {
+  //Accepts either an url as a string or an array of urls. Calls callback with the request for the first url that returns with a 200 code, i.e. success.
+  //If no urls result in a 200 code, callback gets the request for the last url. A url that hasn't answered in timeout ms, FETCH_TIMEOUT if not
+  //given, counts as failed, with status 0. The watch shows network activity while any request is running, unless it is a quiet one in the background.
+
+  var urls = (typeof(url) === 'string') ? [url] : url.slice();
+
+  if (!quiet && (fetchesInFlight++ === 0)) sendMessage({'net': 1});
+
+  function attempt() {
+    var req = new XMLHttpRequest();
+    url = urls.shift();
+    logDebug(function() { return "Web request for url: " + url; });
+    req.open('GET', url, true);
+    req.timeout = timeout || FETCH_TIMEOUT;
+    var done = false;
+    req.onload = req.onerror = req.ontimeout = function() {
+      //Some phones follow a timeout with an error as well.
+      if (done) return;
+      done = true;
+      if ((req.status != 200) && urls.length) {
+        attempt();
+        return;
+      }
+      if (!quiet && (--fetchesInFlight === 0)) sendMessage({'net': 0});
+      callback(req);
+    };
+    req.send(null);
+  }
+  attempt();
+}
 
-  sendMessage({'net': 1});
-  var urls = [];
-  var req = new XMLHttpRequest();
-  
-  if (typeof(url) === 'string') {
-    urls = [url];
-  } else {
-    urls = url;
-    urls.reverse();
+//Flight categories, from best to worst. Sent to the watch as a single byte, and must match the CATEGORY_ values in
+//flightweather.c.
+var CATEGORY_VFR = 0;
+var CATEGORY_MVFR = 1;
+var CATEGORY_IFR = 2;
+var CATEGORY_LIFR = 3;
+
+//Minima for each category below VFR, indexed by category. Conditions are in a category when the ceiling (feet) or
+//the visibility (meters) is below its minima. The IFR minima are the 1500 ft and 5000 m the watch has always given
+//IMC alerts at. Can be overridden with a 'minima' array in the configuration.
+var DEFAULT_MINIMA = [
+  null,
+  { 'ceiling': 3000, 'visibility': 8000 },
+  { 'ceiling': 1500, 'visibility': 5000 },
+  { 'ceiling': 500, 'visibility': 1500 }
+];
+
+//How far conditions must clear the minima of the current category before a better category is reported, so that a
+//report hovering at a limit does not flap between categories and alert every time.
+var HYSTERESIS = { 'ceiling': 200, 'visibility': 500 };
+
+//The last category, and the day and time group of the last report, sent for each station.
+var lastCategory = {};
+var lastIssue = {};
+
+function flightConditions(metar, previous, minima) {
+//Returns the ceiling, visibility and flight category of a parsed metar. The ceiling is the lowest broken, overcast
+//or obscured layer, -1 if there is none. Visibility is -1 if unknown. previous is the category last reported for
+//the station, if any, and is used for hysteresis.
+  var ceiling = -1;
+  var visibility = -1;
+  var category = CATEGORY_VFR;
+
+  (metar.clouds || []).forEach(function(layer) {
+    var abbreviation = layer.abbreviation;
+    if (((abbreviation == 'BKN') || (abbreviation == 'OVC') || (abbreviation == 'VV')) && (layer.altitude !== null) &&
+        ((ceiling < 0) || (layer.altitude < ceiling))) {
+      ceiling = layer.altitude;
+    }
+  });
+
+  if (metar.cavok) {
+    visibility = 10000;
+  } else if ((metar.visibility !== null) && (metar.visibility !== undefined) && !isNaN(metar.visibility)) {
+    //0000 is a visibility, not an unknown one.
+    visibility = Math.round(metar.visibility);
   }
 
-  do {
-    url = urls.pop();
-    console.log("Web request for url: " + url);
-    req.open('GET', url, false);
-    req.send(null);
-  } while ((req.status != 200) && urls);
+  for (var c = CATEGORY_LIFR; c > CATEGORY_VFR; c--) {
+    //Once in a category, conditions must clear its minima by the hysteresis margin to leave it.
+    var margin = ((previous !== undefined) && (previous >= c)) ? 1 : 0;
+    var ceilingBelow = (ceiling > -1) && (ceiling < minima[c].ceiling + margin * HYSTERESIS.ceiling);
+    var visibilityBelow = (visibility > -1) && (visibility < minima[c].visibility + margin * HYSTERESIS.visibility);
+    if (ceilingBelow || visibilityBelow) {
+      category = c;
+      break;
+    }
+  }
+
+  return { 'ceiling': ceiling, 'visibility': visibility, 'category': category };
+}
+
+//Significant weather, sent to the watch as flags in 'wx' so that it can tell when the weather has changed for the
+//worse. Must match the WX_ values in flightweather.c.
+var WX_PRECIPITATION = 1;
+var WX_FREEZING = 2;
+var WX_THUNDERSTORM = 4;
+var WX_OBSCURATION = 8;
+var WX_HEAVY = 0x10;
+var WX_SEVERE = 0x20;
+
+var WX_FLAGS = {
+  '+': WX_HEAVY, 'FZ': WX_FREEZING, 'TS': WX_THUNDERSTORM,
+  'RA': WX_PRECIPITATION, 'DZ': WX_PRECIPITATION, 'SN': WX_PRECIPITATION, 'SG': WX_PRECIPITATION,
+  'IC': WX_PRECIPITATION, 'PL': WX_PRECIPITATION, 'GS': WX_PRECIPITATION, 'UP': WX_PRECIPITATION,
+  'GR': WX_PRECIPITATION | WX_SEVERE,
+  'FG': WX_OBSCURATION, 'BR': WX_OBSCURATION, 'HZ': WX_OBSCURATION, 'DU': WX_OBSCURATION, 'FU': WX_OBSCURATION,
+  'SA': WX_OBSCURATION, 'PY': WX_OBSCURATION, 'VA': WX_OBSCURATION | WX_SEVERE,
+  'SQ': WX_SEVERE, 'FC': WX_SEVERE, 'DS': WX_SEVERE, 'SS': WX_SEVERE, 'PO': WX_SEVERE
+};
+
+function weatherFlags(metar) {
+//Returns the WX_ flags of the weather in a parsed metar. Cumulonimbus counts as thunderstorm.
+  var flags = 0;
+  (metar.weather || []).forEach(function(group) {
+    group.forEach(function(entry) {
+      flags |= WX_FLAGS[entry.abbreviation] || 0;
+    });
+  });
+  (metar.clouds || []).forEach(function(layer) {
+    if (layer.cumulonimbus) flags |= WX_THUNDERSTORM;
+  });
+  return flags;
+}
+
+function windKnots(wind, speed) {
+//Returns the wind speed, or the given speed in the unit of the wind, in knots. -1 if it is not known.
+  var factor = { 'KT': 1, 'MPS': 1.944, 'KPH': 0.54 }[wind.unit];
+  if (speed === undefined) speed = wind.speed;
+  if (!factor || (speed === null) || isNaN(speed)) return -1;
+  return Math.round(speed * factor);
+}
+
+//Runways. RUNWAY_TABLE is generated at build time by tools/runways.py from resources/data/runways.csv and added
+//after this file: RUNWAY_RECORD byte records of station, elevation, heading, suffix and magnetic variation, sorted by
+//station.
+var BASE64 = 'ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/';
+var runwayBytes = null;
+
+function decodeBase64(s) {
+//Returns the bytes of a base64 string as an array. PebbleKit JS can't be relied on to have atob.
+  var bytes = [], bits = 0, value = 0;
+  for (var i = 0; i < s.length; i++) {
+    var c = BASE64.indexOf(s.charAt(i));
+    if (c < 0) continue;
+    value = (value << 6) | c;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      bytes.push((value >> bits) & 0xff);
+    }
+  }
+  return bytes;
+}
+
+function runwayStation(i) {
+  var o = i * RUNWAY_RECORD;
+  return String.fromCharCode(runwayBytes[o], runwayBytes[o + 1], runwayBytes[o + 2], runwayBytes[o + 3]);
+}
+
+function runwaysFor(station) {
+//Returns { 'elevation': feet, 'variation': degrees, 'runways': [{ 'heading': degrees, 'suffix': 'L' }, ...] } for a
+//station, or null if it is not in the table. Headings are the magnetic ones of the lower numbered end, and variation
+//is the magnetic variation, east positive.
+  if (typeof RUNWAY_TABLE === 'undefined') return null;
+  if (!runwayBytes) runwayBytes = decodeBase64(RUNWAY_TABLE);
+  station = station.toUpperCase();
+
+  var lo = 0, hi = runwayBytes.length / RUNWAY_RECORD;
+  while (lo < hi) {
+    var mid = (lo + hi) >> 1;
+    if (runwayStation(mid) < station) lo = mid + 1; else hi = mid;
+  }
+
+  var result = null;
+  for (var i = lo; (i < runwayBytes.length / RUNWAY_RECORD) && (runwayStation(i) == station); i++) {
+    var o = i * RUNWAY_RECORD;
+    var elevation = runwayBytes[o + 4] | (runwayBytes[o + 5] << 8);
+    result = result || { 'elevation': elevation >= 0x8000 ? elevation - 0x10000 : elevation,
+                         'variation': runwayBytes[o + 9] >= 0x80 ? runwayBytes[o + 9] - 0x100 : runwayBytes[o + 9],
+                         'runways': [] };
+    result.runways.push({ 'heading': runwayBytes[o + 6] | (runwayBytes[o + 7] << 8),
+                          'suffix': runwayBytes[o + 8] ? String.fromCharCode(runwayBytes[o + 8]) : '' });
+  }
+  return result;
+}
+
+function runwayMessage(airport) {
+//Packs the runways of an airport for the watch: the magnetic variation as a signed byte, then three bytes for each
+//runway, the heading little endian and the suffix.
+  var bytes = [airport.variation & 0xff];
+  airport.runways.forEach(function(runway) {
+    bytes.push(runway.heading & 0xff, runway.heading >> 8, runway.suffix ? runway.suffix.charCodeAt(0) : 0);
+  });
+  return bytes;
+}
+
+//Decoded view. PHRASE_IDS and PHRASE_ARGS are generated at build time by tools/phrases.py from
+//resources/data/phrases.json and added before this file. The watch has the same phrases, so a report is sent as the
+//ids of its phrases, each followed by its numbers as zigzag varints, instead of as text.
+function pushVarint(bytes, value) {
+  var raw = value < 0 ? -2 * value - 1 : 2 * value;
+  while (raw >= 0x80) {
+    bytes.push((raw & 0x7f) | 0x80);
+    raw = Math.floor(raw / 0x80);
+  }
+  bytes.push(raw);
+}
+
+function phraseMessage(metar) {
+//Returns the phrases of a parsed metar for the watch to render its decoded view from, or null if there are none.
+  if (typeof PHRASE_IDS === 'undefined') return null;
+  var bytes = [];
+  function phrase(name) {
+    var id = PHRASE_IDS[name];
+    if (id === undefined) return;
+    bytes.push(id);
+    for (var i = 0; i < PHRASE_ARGS[id]; i++) pushVarint(bytes, Math.round(arguments[i + 1]) || 0);
+  }
+  function line() {
+    if (bytes.length) phrase('NEWLINE');
+  }
+
+  var speed = windKnots(metar.wind);
+  if (speed === 0) {
+    phrase('WIND_CALM');
+  } else if (speed > 0) {
+    if (typeof metar.wind.direction === 'number' && !isNaN(metar.wind.direction)) {
+      phrase('WIND', metar.wind.direction, speed);
+    } else {
+      phrase('WIND_VARIABLE', speed);
+    }
+    if (metar.wind.gust !== null) phrase('WIND_GUST', windKnots(metar.wind, metar.wind.gust));
+    if (metar.wind.variation && (typeof metar.wind.variation === 'object')) {
+      phrase('WIND_VARYING', metar.wind.variation.min, metar.wind.variation.max);
+    }
+  }
+
+  if (metar.cavok) {
+    line();
+    phrase('CAVOK');
+  } else if (metar.visibility !== null) {
+    line();
+    if (metar.visibility >= 9999) {
+      phrase('VISIBILITY_10KM');
+    } else {
+      phrase('VISIBILITY', metar.visibility);
+    }
+  }
+
+  (metar.weather || []).forEach(function(group) {
+    line();
+    group.forEach(function(weather) { phrase('WX:' + weather.abbreviation); });
+  });
+
+  (metar.clouds || []).forEach(function(layer, i) {
+    if (i) {
+      phrase('COMMA');
+    } else {
+      line();
+    }
+    phrase('CLOUDS:' + layer.abbreviation);
+    if (layer.altitude !== null) phrase('CLOUDS_AT', layer.altitude / 100);
+    if (layer.cumulonimbus) phrase('CUMULONIMBUS');
+  });
+
+  if (metar.temperature !== null) {
+    line();
+    phrase('TEMPERATURE', metar.temperature);
+    if (metar.dewpoint !== null) phrase('DEWPOINT', metar.dewpoint);
+  }
+  if (metar.qnh !== null) {
+    line();
+    phrase('QNH', metar.qnh);
+  }
+  return bytes.length ? bytes : null;
+}
 
-  sendMessage({'net': 0});
-  return req;
+function stationElevation(station) {
+//Returns the elevation in feet of a station, from the 'elevations' of the configuration or else from the runway
+//table, or null if not known.
+  var elevations = configuration.elevations || {};
+  var elevation = elevations[station.toUpperCase()];
+  if (typeof elevation === 'number') return Math.round(elevation);
+  var airport = runwaysFor(station);
+  return airport ? airport.elevation : null;
 }
 
-function fetchMetar(station) {
-//Fetches metar for a given station.
-  var response;
-  var raw_text;
-  var city;
-  var metar;
+function reportMetar(station, raw_text, trace) {
+//Parses a metar and sends it to the watch, along with the flight conditions.
+  var d = new Date();
+
+  var parseStarted = Date.now();
+  var metar = parseMETAR(raw_text);
+  var conditions = flightConditions(metar, lastCategory[station.toUpperCase()], configuration.minima || DEFAULT_MINIMA);
+  lastCategory[station.toUpperCase()] = conditions.category;
+  lastIssue[station.toUpperCase()] = reportIssue(raw_text);
+  recordLatency('parse', Date.now() - parseStarted);
+
+  //Yes, visibility is measured in meters and cloud height in feet. Flying is a standards nightmare.
+  
+  //var seconds_ago = Math.round(d.getTime() - metar.time.getTime()) / 1000;
+  var seconds_ago = Math.round(metar.time.getTime() / 1000 - d.getTimezoneOffset() * 60);
+
+  //The watch renders any alert text itself from the category, ceiling and visibility.
+  var message = {"updated": seconds_ago, "metar": raw_text, "category": conditions.category,
+                 "ceiling": conditions.ceiling, "visibility": conditions.visibility, "wind": windKnots(metar.wind),
+                 "wx": weatherFlags(metar)};
+
+  //Pressure and density altitude are worked out on the watch. Whatever is not known is left out.
+  var elevation = stationElevation(station);
+  if (metar.temperature !== null) message.temperature = metar.temperature;
+  if (metar.dewpoint !== null) message.dewpoint = metar.dewpoint;
+  if (metar.qnh !== null) message.qnh = Math.round(metar.qnh * 10);
+  if (elevation !== null) message.elevation = elevation;
+
+  //The watch works out the wind components for each runway.
+  var airport = runwaysFor(station);
+  if (airport) message.runways = runwayMessage(airport);
+  if (typeof metar.wind.direction === 'number' && !isNaN(metar.wind.direction)) {
+    message.winddir = metar.wind.direction;
+  }
+  if (metar.wind.gust !== null) message.gust = windKnots(metar.wind, metar.wind.gust);
+
+  //The watch renders the decoded view itself from the phrases, when it is asked for.
+  var phrases = phraseMessage(metar);
+  if (phrases) message.phrases = phrases;
+  sendMessage(traced(message, trace));
+}
 
-  var urls = [
-    'http://olofbeckman.se/metar/station/' + station.toUpperCase(),
-    'http://weather.noaa.gov/pub/data/observations/metar/stations/' + station.toUpperCase() + '.TXT'
+function metarUrls(station) {
+  return [
+    'http://olofbeckman.se/metar/station/' + station,
+    'http://weather.noaa.gov/pub/data/observations/metar/stations/' + station + '.TXT'
   ];
+}
 
-  var req = fetchWeb(urls);
+function locationUrl(latitude, longitude) {
+  return 'http://olofbeckman.se/metar/location?lat=' + latitude + '&lon=' + longitude;
+}
 
-  if (req.status == 200) {
-    //The return is just a two line text file, where the first line is a timestamp. The second line is the metar. I should probably check for validity at this point. TODO.
-    raw_text = req.responseText; //.split("\n")[1]; 
-    var d = new Date();
-    var hours = d.getHours();
-    var minutes = d.getMinutes();
-
-    var lowestCloud = -1;
-    var lowestCloudType = "";
-    var message = "";
-
-    metar = parseMETAR(raw_text);
-    if (metar.clouds) {
-      //Cycle through all the clouds and find which are at the lowest level. Save the type of that cloud.
-      metar.clouds.forEach(function(entry) {
-        if ((entry.abbreviation != 'VV') && (entry.altitude) && ((lowestCloud < 0) || (entry.altitude < lowestCloud))) {
-          lowestCloud = entry.altitude;
-          lowestCloudType = entry.meaning;
-        }
-      });
-    }    
+function fetchMetar(station, trace, direct) {
+//Fetches metar for a given station. Joins the fetch for the same station if one is already in flight. A report
+//prefetched for the route ahead is sent instead, once, if it is fresh and newer than the last one sent. In snapshot
+//mode, the report is taken from the snapshot unless direct is set.
+  station = station.toUpperCase();
+  if (configuration.snapshot && !direct) {
+    snapshotTable(function(table) {
+      var raw_text = table ? snapshotReport(table, station) : null;
+      if (!raw_text) {
+        fetchMetar(station, trace, true);
+        return;
+      }
+      reportMetar(station, raw_text, trace);
+      subscribe(station, raw_text);
+    });
+    return;
+  }
+  var cached = prefetch.metars[station];
+  delete prefetch.metars[station];
+  if (cached && (Date.now() - cached.fetched < PREFETCH_FRESH) &&
+      (reportIssue(cached.raw_text) > (lastIssue[station] || ''))) {
+    logInfo(function() { return "Sending prefetched metar for " + station + "."; });
+    reportMetar(station, cached.raw_text, trace);
+    subscribe(station, cached.raw_text);
+    return;
+  }
+  if (joinable(inFlight.metar[station])) {
+    joinFlight(inFlight.metar[station], trace);
+    return;
+  }
+  var flight = inFlight.metar[station] = startFlight(trace);
+
+  var fetchStarted = Date.now();
+  fetchWeb(metarUrls(station), function(req) {
+    var raw_text;
+    recordLatency('fetch', Date.now() - fetchStarted);
+    if (inFlight.metar[station] === flight) delete inFlight.metar[station];
+    trace = landFlight(flight);
+
+    if (req.status == 200) {
+      //The return is just a two line text file, where the first line is a timestamp. The second line is the metar. I should probably check for validity at this point. TODO.
+      raw_text = req.responseText; //.split("\n")[1]; 
+      reportMetar(station, raw_text, trace);
+      subscribe(station, raw_text);
+    } else {
+      //Web request unsuccessful. Reported by setting 'net' to zero.
+      logWarning(function() { return "Metar check failed with error " + req.status; });
+      sendMessage(traced({"net": 0}, trace));
+    }
+  });
+}
 
-    //console.log("Lowest altitude of clouds found were: " + lowestCloud);
+//Push updates. While the app runs, it keeps a long-poll open for the current station. The server answers it as
+//soon as a report newer than 'since' is published, or with 204 when it has held the request for a while without
+//one. New reports are sent to the watch right away, and while the subscription works the watch is told, with
+//'push', that it can poll less often. If the subscription fails, the watch goes back to normal polling and the
+//app tries again after SUBSCRIBE_RETRY, twice that after a second failure in a row and so on, up to
+//SUBSCRIBE_RETRY_MAX. A 4xx answer won't change by asking again, so after one the app stops subscribing until the
+//next init or configuration change.
+var SUBSCRIBE_URL = 'http://olofbeckman.se/metar/subscribe/';
+var SUBSCRIBE_TIMEOUT = 15 * 60 * 1000;
+var SUBSCRIBE_RETRY = 5 * 60 * 1000;
+var SUBSCRIBE_RETRY_MAX = 2 * 60 * 60 * 1000;
+var subscription = null;
+var subscribeRefused = false;
+
+function reportIssue(raw_text) {
+//Returns the day and time group of a metar, i.e. '181220Z', which identifies the report of a station.
+  var fields = raw_text.split(" ");
+  return fields[1] || "";
+}
 
-    if ((lowestCloud > -1) && (lowestCloud < 1500)) {
-      //If clouds are found below 1500 feet we have IMC (not really though, they have to be of type OVC or BKN which is a TODO.)
-      message = "There are " + lowestCloudType + " clouds at " + lowestCloud + " feet\n";
+function setPush(active) {
+//Tells the watch whether push updates are working, if that has changed.
+  if (subscription && (subscription.active != active)) {
+    subscription.active = active;
+    sendMessage({"push": active ? 1 : 0});
+  }
+}
+
+function pollSubscription(s) {
+//Holds a long-poll open for subscription s, until it is replaced or fails.
+  if (subscription !== s) return;
+  var req = new XMLHttpRequest();
+  s.req = req;
+  req.open('GET', SUBSCRIBE_URL + s.station + '?since=' + encodeURIComponent(s.since), true);
+  req.timeout = SUBSCRIBE_TIMEOUT + 60 * 1000;
+  req.onload = function() {
+    if (subscription !== s) return;
+    if (req.status == 200 && req.responseText) {
+      s.failures = 0;
+      setPush(true);
+      if (reportIssue(req.responseText) != s.since) {
+        s.since = reportIssue(req.responseText);
+        reportMetar(s.station, req.responseText, null);
+      }
+      pollSubscription(s);
+    } else if (req.status == 204) {
+      s.failures = 0;
+      setPush(true);
+      pollSubscription(s);
+    } else {
+      subscriptionFailed(s, req.status);
     }
+  };
+  req.onerror = req.ontimeout = function() {
+    subscriptionFailed(s, 0);
+  };
+  req.send(null);
+}
 
-    if ((metar.visibility) && (metar.visibility < 5000)) {
-      //If visibility is lower than 5000 meters, we have IMC.
-      if (metar.statuevisibility) {
-        message += "Visibility: " + metar.statuevisibility;
-      } else {
-        message += "Visibility: " + metar.visibility + "m";
+function subscriptionFailed(s, status) {
+//Gives up on subscriptions after a 4xx status, and else retries s with exponential backoff.
+  if (subscription !== s) return;
+  logWarning(function() { return "Metar subscription for " + s.station + " failed with status " + status + "."; });
+  if ((status >= 400) && (status < 500)) {
+    subscribeRefused = true;
+    unsubscribe();
+    return;
+  }
+  setPush(false);
+  var delay = Math.min(SUBSCRIBE_RETRY * Math.pow(2, s.failures), SUBSCRIBE_RETRY_MAX);
+  s.failures++;
+  s.retry = setTimeout(function() {
+    s.retry = null;
+    pollSubscription(s);
+  }, delay);
+}
+
+function subscribe(station, raw_text) {
+//Subscribes to new reports for station, replacing any earlier subscription. raw_text is the latest report.
+  station = station.toUpperCase();
+  if ((configuration.push === false) || subscribeRefused) return;
+  if (subscription && (subscription.station == station)) {
+    subscription.since = reportIssue(raw_text);
+    return;
+  }
+  unsubscribe();
+  subscription = { 'station': station, 'since': reportIssue(raw_text), 'active': false, 'req': null, 'retry': null,
+                   'failures': 0 };
+  pollSubscription(subscription);
+}
+
+function unsubscribe() {
+  if (!subscription) return;
+  if (subscription.req) subscription.req.abort();
+  if (subscription.retry) clearTimeout(subscription.retry);
+  setPush(false);
+  subscription = null;
+}
+
+//Route-ahead prefetch. In flight the nearest station changes every few minutes, and each change would cost a station
+//lookup and a metar fetch before the watch shows anything. With a ground speed of at least PREFETCH_MIN_SPEED, the
+//track is projected up to PREFETCH_HORIZON ahead, in steps of PREFETCH_STEP, from the heading and speed of the fix
+//or else from the last two fixes. The stations nearest to the projected points are looked up, and their reports
+//fetched, quietly in the background. A later fix within half a step of a projected point takes its station without
+//a lookup, and the report is sent from memory when the watch asks for it. Off with 'prefetch': false in the
+//configuration.
+var PREFETCH_MIN_SPEED = 30;                    // m/s, about 60 kt.
+var PREFETCH_STEP = 5;                          // Minutes.
+var PREFETCH_HORIZON = 60;                      // Minutes.
+var PREFETCH_MATCH = 5000;                      // m. Least distance at which a fix is taken to be at a point.
+var PREFETCH_FRESH = 10 * 60 * 1000;            // Prefetched reports older than this are fetched again instead.
+var PREFETCH_EXPIRY = 90 * 60 * 1000;           // Projected points and their reports are forgotten after this.
+var PREFETCH_HUNG = 5 * 60 * 1000;              // A pass still running after this is abandoned for a new one.
+var EARTH_RADIUS = 6371000;                     // m.
+
+var prefetch = { 'points': [], 'metars': {}, 'fix': null, 'running': null };
+
+function toRadians(degrees) {
+  return degrees * Math.PI / 180;
+}
+
+function distance(latitude1, longitude1, latitude2, longitude2) {
+//Returns the great circle distance in meters between two points.
+  var dLatitude = toRadians(latitude2 - latitude1);
+  var dLongitude = toRadians(longitude2 - longitude1);
+  var a = Math.sin(dLatitude / 2) * Math.sin(dLatitude / 2) + Math.cos(toRadians(latitude1)) *
+    Math.cos(toRadians(latitude2)) * Math.sin(dLongitude / 2) * Math.sin(dLongitude / 2);
+  return 2 * EARTH_RADIUS * Math.atan2(Math.sqrt(a), Math.sqrt(1 - a));
+}
+
+function bearing(latitude1, longitude1, latitude2, longitude2) {
+//Returns the initial true bearing in degrees from one point to another.
+  var phi1 = toRadians(latitude1), phi2 = toRadians(latitude2);
+  var dLongitude = toRadians(longitude2 - longitude1);
+  var y = Math.sin(dLongitude) * Math.cos(phi2);
+  var x = Math.cos(phi1) * Math.sin(phi2) - Math.sin(phi1) * Math.cos(phi2) * Math.cos(dLongitude);
+  return (Math.atan2(y, x) * 180 / Math.PI + 360) % 360;
+}
+
+function project(latitude, longitude, heading, meters) {
+//Returns the point meters away from a point along a great circle with the given initial true heading.
+  var delta = meters / EARTH_RADIUS;
+  var theta = toRadians(heading);
+  var phi1 = toRadians(latitude), lambda1 = toRadians(longitude);
+  var phi2 = Math.asin(Math.sin(phi1) * Math.cos(delta) + Math.cos(phi1) * Math.sin(delta) * Math.cos(theta));
+  var lambda2 = lambda1 + Math.atan2(Math.sin(theta) * Math.sin(delta) * Math.cos(phi1),
+    Math.cos(delta) - Math.sin(phi1) * Math.sin(phi2));
+  return { 'latitude': phi2 * 180 / Math.PI, 'longitude': ((lambda2 * 180 / Math.PI) + 540) % 360 - 180 };
+}
+
+function groundTrack(pos) {
+//Returns the heading in degrees and speed in m/s of a fix, from the fix itself or from the previous one, or null if
+//neither tells.
+  var coords = pos.coords;
+  var fix = { 'latitude': coords.latitude, 'longitude': coords.longitude, 'time': pos.timestamp || Date.now() };
+  var previous = prefetch.fix;
+  prefetch.fix = fix;
+  if ((typeof coords.heading === 'number') && !isNaN(coords.heading) && (typeof coords.speed === 'number') &&
+      !isNaN(coords.speed)) {
+    return { 'heading': coords.heading, 'speed': coords.speed };
+  }
+  var seconds = previous ? (fix.time - previous.time) / 1000 : 0;
+  if ((seconds < 60) || (seconds > 30 * 60)) return null;
+  return {
+    'heading': bearing(previous.latitude, previous.longitude, fix.latitude, fix.longitude),
+    'speed': distance(previous.latitude, previous.longitude, fix.latitude, fix.longitude) / seconds
+  };
+}
+
+function expirePrefetch() {
+//Forgets projected points and reports that are too old to be of use.
+  var now = Date.now();
+  prefetch.points = prefetch.points.filter(function(point) { return now - point.resolved < PREFETCH_EXPIRY; });
+  Object.keys(prefetch.metars).forEach(function(station) {
+    if (now - prefetch.metars[station].fetched >= PREFETCH_EXPIRY) delete prefetch.metars[station];
+  });
+}
+
+function stationAt(latitude, longitude, radius) {
+//Returns the station of the projected point closest to a position, if it is within radius of it, or else within
+//the radius of the point. null if there is none.
+  var best = null, bestDistance = Infinity;
+  prefetch.points.forEach(function(point) {
+    var d = distance(latitude, longitude, point.latitude, point.longitude);
+    if ((d < Math.max(radius, point.radius)) && (d < bestDistance)) {
+      best = point;
+      bestDistance = d;
+    }
+  });
+  return best ? best.station : null;
+}
+
+function stationAhead(latitude, longitude) {
+//Returns the station of a fix if it is on a projected track, and the report of the station has been prefetched.
+  expirePrefetch();
+  var station = stationAt(latitude, longitude, 0);
+  return (station && prefetch.metars[station]) ? station : null;
+}
+
+function prefetchAhead(pos, track) {
+//Projects the track of a fix ahead, and looks up and fetches the stations along it one at a time. track is the
+//groundTrack of the fix.
+  if ((configuration.prefetch === false) || configuration.snapshot || !track || (track.speed < PREFETCH_MIN_SPEED)) return;
+  if (prefetch.running && (Date.now() - prefetch.running.started < PREFETCH_HUNG)) return;
+  expirePrefetch();
+
+  var points = [];
+  var radius = Math.max(PREFETCH_MATCH, track.speed * PREFETCH_STEP * 60 / 2);
+  for (var minutes = PREFETCH_STEP; minutes <= PREFETCH_HORIZON; minutes += PREFETCH_STEP) {
+    var point = project(pos.coords.latitude, pos.coords.longitude, track.heading, track.speed * minutes * 60);
+    point.radius = radius;
+    if (stationAt(point.latitude, point.longitude, radius) === null) points.push(point);
+  }
+  logDebug(function() { return "Prefetching " + points.length + " points ahead on " + Math.round(track.heading) + "."; });
+
+  //An abandoned pass stops at its next step.
+  var run = prefetch.running = { 'started': Date.now() };
+  function next() {
+    if (prefetch.running !== run) return;
+    var point = points.shift();
+    if (!point) {
+      prefetch.running = null;
+      return;
+    }
+    fetchWeb(locationUrl(point.latitude, point.longitude), function(req) {
+      if ((req.status != 200) || !req.responseText) {
+        next();
+        return;
       }
+      point.station = req.responseText.toUpperCase();
+      point.resolved = Date.now();
+      prefetch.points.push(point);
+      var cached = prefetch.metars[point.station];
+      if (cached && (Date.now() - cached.fetched < PREFETCH_FRESH)) {
+        next();
+        return;
+      }
+      fetchWeb(metarUrls(point.station), function(req) {
+        if (req.status == 200) {
+          prefetch.metars[point.station] = { 'raw_text': req.responseText, 'fetched': Date.now() };
+        }
+        next();
+      }, true);
+    }, true);
+  }
+  next();
+}
+
+//Hazards. The SIGMET and AIRMET polygons in force are fetched from HAZARD_URL at most every HAZARD_REFRESH, and
+//indexed in an R-tree. On each location update, the fix is checked against them, and so is the track ahead for
+//HAZARD_HORIZON when it is known. The watch gets a single 'hazard' integer: the HAZARD_ flags of the hazards at the
+//fix in the lowest byte, those of the hazards ahead in the next, and the minutes until the first one ahead is entered
+//in the third. It is only sent when it changes. Off with 'hazards': false in the configuration.
+//
+//Polygons are treated as flat in degrees of latitude and longitude, which is close enough over the distances involved
+//away from the poles, and they must not cross the antimeridian.
+var HAZARD_URL = 'http://olofbeckman.se/metar/hazards';
+var HAZARD_REFRESH = 15 * 60 * 1000;
+var HAZARD_HORIZON = 60;                        // Minutes.
+var HAZARD_MIN_SPEED = 10;                      // m/s. Slower than this, there is no track ahead to check.
+var RTREE_NODE = 8;                             // Children per R-tree node.
+
+//Kinds of hazard, as sent in 'hazard'. Must match the HAZARD_ values in flightweather.c.
+var HAZARD_TS = 1;
+var HAZARD_TURB = 2;
+var HAZARD_ICE = 4;
+var HAZARD_IFR = 8;
+var HAZARD_MTN = 0x10;
+var HAZARD_ASH = 0x20;
+var HAZARD_OTHER = 0x40;
+var HAZARD_SIGMET = 0x80;                       // At least one of the hazards is a SIGMET rather than an AIRMET.
+
+var HAZARD_KINDS = {
+  'TS': HAZARD_TS, 'TSGR': HAZARD_TS, 'CB': HAZARD_TS, 'TURB': HAZARD_TURB, 'LLWS': HAZARD_TURB,
+  'ICE': HAZARD_ICE, 'IFR': HAZARD_IFR, 'MTN': HAZARD_MTN, 'MT OBSC': HAZARD_MTN, 'VA': HAZARD_ASH, 'ASH': HAZARD_ASH
+};
+
+var hazards = { 'items': [], 'index': null, 'fetched': 0, 'fetching': false, 'sent': 0 };   // sent as on the watch.
+
+function boxOf(ring) {
+//Returns the bounding box [west, south, east, north] of a ring of [longitude, latitude] points.
+  var box = [Infinity, Infinity, -Infinity, -Infinity];
+  ring.forEach(function(p) {
+    box[0] = Math.min(box[0], p[0]);
+    box[1] = Math.min(box[1], p[1]);
+    box[2] = Math.max(box[2], p[0]);
+    box[3] = Math.max(box[3], p[1]);
+  });
+  return box;
+}
+
+function overlaps(a, b) {
+  return (a[0] <= b[2]) && (b[0] <= a[2]) && (a[1] <= b[3]) && (b[1] <= a[3]);
+}
+
+function packLevel(nodes) {
+//Groups nodes into parents of RTREE_NODE children, sort-tile-recursive: in vertical slices by longitude, and each
+//slice in runs by latitude.
+  var parents = [];
+  var slices = Math.ceil(Math.sqrt(Math.ceil(nodes.length / RTREE_NODE)));
+  var sliceSize = slices * RTREE_NODE;
+  nodes.sort(function(a, b) { return (a.box[0] + a.box[2]) - (b.box[0] + b.box[2]); });
+  for (var i = 0; i < nodes.length; i += sliceSize) {
+    var slice = nodes.slice(i, i + sliceSize);
+    slice.sort(function(a, b) { return (a.box[1] + a.box[3]) - (b.box[1] + b.box[3]); });
+    for (var j = 0; j < slice.length; j += RTREE_NODE) {
+      var children = slice.slice(j, j + RTREE_NODE);
+      var box = children[0].box.slice();
+      children.forEach(function(child) {
+        box[0] = Math.min(box[0], child.box[0]);
+        box[1] = Math.min(box[1], child.box[1]);
+        box[2] = Math.max(box[2], child.box[2]);
+        box[3] = Math.max(box[3], child.box[3]);
+      });
+      parents.push({ 'box': box, 'children': children });
+    }
+  }
+  return parents;
+}
+
+function buildRTree(items) {
+//Returns an R-tree of items, each with a 'box', bulk loaded in one go. null if there are none.
+  if (!items.length) return null;
+  var nodes = items.map(function(item) { return { 'box': item.box, 'item': item }; });
+  do {
+    nodes = packLevel(nodes);
+  } while (nodes.length > 1);
+  return nodes[0];
+}
+
+function searchRTree(node, box, callback) {
+//Calls callback with each item in the tree whose box overlaps box.
+  if (!node || !overlaps(node.box, box)) return;
+  if (node.item) {
+    callback(node.item);
+    return;
+  }
+  for (var i = 0; i < node.children.length; i++) {
+    searchRTree(node.children[i], box, callback);
+  }
+}
+
+function pointInPolygon(p, ring) {
+//Returns true if point p is inside the ring, by counting the edges a ray from it crosses.
+  var inside = false;
+  for (var i = 0, j = ring.length - 1; i < ring.length; j = i++) {
+    var a = ring[i], b = ring[j];
+    if (((a[1] > p[1]) != (b[1] > p[1])) && (p[0] < (b[0] - a[0]) * (p[1] - a[1]) / (b[1] - a[1]) + a[0])) {
+      inside = !inside;
     }
+  }
+  return inside;
+}
 
-    //Yes, visibility is measured in meters and cloud height in feet. Flying is a standards nightmare.
-    
-    //var seconds_ago = Math.round(d.getTime() - metar.time.getTime()) / 1000;
-    console.log(d.getTimezoneOffset());
-    var seconds_ago = Math.round(metar.time.getTime() / 1000 - d.getTimezoneOffset() * 60);
+function segmentEntry(p, q, ring) {
+//Returns where the segment from p to q first crosses an edge of the ring, as a share of its length, or -1 if it
+//does not.
+  var first = -1;
+  var rx = q[0] - p[0], ry = q[1] - p[1];
+  for (var i = 0, j = ring.length - 1; i < ring.length; j = i++) {
+    var a = ring[j], b = ring[i];
+    var sx = b[0] - a[0], sy = b[1] - a[1];
+    var denominator = rx * sy - ry * sx;
+    if (denominator === 0) continue;
+    var ax = a[0] - p[0], ay = a[1] - p[1];
+    var t = (ax * sy - ay * sx) / denominator;
+    var u = (ax * ry - ay * rx) / denominator;
+    if ((t >= 0) && (t <= 1) && (u >= 0) && (u <= 1) && ((first < 0) || (t < first))) first = t;
+  }
+  return first;
+}
 
-    if (message) {
-      //If message is set, we have IMC conditions and report those. Watchapp will assume VMC if clouds is not set.
-      sendMessage({"updated": seconds_ago, "metar": raw_text, "clouds": message});
+function parseHazards(text) {
+//Returns the hazards of a HAZARD_URL reply: a JSON array of { 'type': 'SIGMET' or 'AIRMET', 'hazard': i.e. 'TS',
+//'from' and 'to' in seconds since the epoch, 'polygon': [[latitude, longitude], ...] }. Malformed ones are skipped.
+  var list;
+  try {
+    list = JSON.parse(text);
+  } catch (e) {
+    logWarning("Hazards could not be parsed.");
+    return [];
+  }
+  var items = [];
+  (Array.isArray(list) ? list : []).forEach(function(hazard) {
+    if (!hazard || !Array.isArray(hazard.polygon) || (hazard.polygon.length < 3)) return;
+    var ring = hazard.polygon.map(function(point) { return [point[1], point[0]]; });
+    items.push({
+      'box': boxOf(ring),
+      'ring': ring,
+      'flags': (HAZARD_KINDS[hazard.hazard] || HAZARD_OTHER) | (hazard.type == 'SIGMET' ? HAZARD_SIGMET : 0),
+      'from': (hazard.from || 0) * 1000,
+      'to': hazard.to ? hazard.to * 1000 : Infinity
+    });
+  });
+  return items;
+}
+
+function fetchHazards(callback) {
+//Fetches and indexes the hazards in force, quietly, and calls callback when done, whether it worked or not.
+  hazards.fetching = true;
+  fetchWeb(HAZARD_URL, function(req) {
+    hazards.fetching = false;
+    hazards.fetched = Date.now();
+    if (req.status == 200) {
+      var started = Date.now();
+      hazards.items = parseHazards(req.responseText);
+      hazards.index = buildRTree(hazards.items.slice());
+      recordLatency('hazards', Date.now() - started);
     } else {
-      //If message is not set, we have VMC conditions.
-      sendMessage({"updated": seconds_ago, "metar": raw_text});
+      logWarning(function() { return "Hazards could not be fetched: " + req.status; });
     }
+    callback();
+  }, true);
+}
 
-    
-    //city = hours + ':' + (minutes < 10 ? "0" : "") + minutes;        
-    //console.log(city + " - " + raw_text);
-    
-  } else {
-    //Web request unsuccessful. Reported by setting 'net' to zero.
-    console.log("Metar check failed with error " + req.status);
-    sendMessage({"net": 0});
+function hazardSummary(latitude, longitude, track, now) {
+//Returns the 'hazard' summary for a fix and its ground track, which may be null.
+  var here = 0, ahead = 0, entry = -1;
+  var p = [longitude, latitude];
+  searchRTree(hazards.index, [p[0], p[1], p[0], p[1]], function(hazard) {
+    if ((hazard.from <= now) && (now < hazard.to) && pointInPolygon(p, hazard.ring)) here |= hazard.flags;
+  });
+
+  if (track && (track.speed >= HAZARD_MIN_SPEED)) {
+    var end = project(latitude, longitude, track.heading, track.speed * HAZARD_HORIZON * 60);
+    var q = [end.longitude, end.latitude];
+    var box = [Math.min(p[0], q[0]), Math.min(p[1], q[1]), Math.max(p[0], q[0]), Math.max(p[1], q[1])];
+    searchRTree(hazards.index, box, function(hazard) {
+      if ((hazard.to <= now) || pointInPolygon(p, hazard.ring)) return;
+      var t = segmentEntry(p, q, hazard.ring);
+      //Only hazards in force when they are reached count.
+      if ((t < 0) || (hazard.from > now + t * HAZARD_HORIZON * 60000)) return;
+      ahead |= hazard.flags;
+      if ((entry < 0) || (t < entry)) entry = t;
+    });
   }
+
+  var minutes = entry < 0 ? 0 : Math.min(255, Math.max(1, Math.ceil(entry * HAZARD_HORIZON)));
+  return here | (ahead << 8) | (minutes << 16);
 }
 
-function locationSuccess(pos) {
+function checkHazards(pos, track) {
+//Sends the hazard summary of a fix to the watch, if it has changed. Fetches the hazards first if they are old.
+  if (configuration.hazards === false) return;
+  if (!hazards.fetching && (Date.now() - hazards.fetched >= HAZARD_REFRESH)) {
+    fetchHazards(function() {
+      checkHazards(pos, track);
+    });
+    return;
+  }
+  var summary = hazardSummary(pos.coords.latitude, pos.coords.longitude, track, Date.now());
+  if (summary !== hazards.sent) {
+    hazards.sent = summary;
+    sendMessage({'hazard': summary});
+  }
+}
+
+//Snapshot mode. With 'snapshot': true in the configuration, the app downloads all current reports of the region
+//from SNAPSHOT_URL once per publication cycle, instead of asking for stations one at a time. 'region' in the
+//configuration is passed on to the server, which picks one by position otherwise. The snapshot is a CSV in the
+//layout of NOAA's metars.cache.csv; the server gzips it, and the phone's HTTP stack inflates it, as PebbleKit JS has
+//nothing to inflate with itself. It is kept decoded in columns, with a grid of SNAPSHOT_CELL degree cells over the
+//stations for nearest station lookups. Station and location requests are then answered from it with no further
+//requests, and there is no need to prefetch along the route. Stations that are not in it are asked for as usual.
+var SNAPSHOT_URL = 'http://olofbeckman.se/metar/snapshot';
+var SNAPSHOT_REFRESH = 30 * 60 * 1000;          // A publication cycle.
+var SNAPSHOT_CELL = 1;                          // Degrees.
+var SNAPSHOT_MAX_RING = 30;                     // Cells out from a position that a nearest station is looked for in.
+var SNAPSHOT_TIMEOUT = 60 * 1000;               // For the download, which is much larger than other replies.
+var SNAPSHOT_HUNG = 2 * 60 * 1000;              // A download still running after this is abandoned for a new one.
+var SNAPSHOT_RETRY = 2 * 60 * 1000;             // After a failed download, doubled for each failure in a row.
+
+var snapshot = { 'table': null, 'fetched': 0, 'waiting': null, 'failures': 0, 'retryAt': 0 };
+
+function snapshotCell(latitude, longitude) {
+  return (Math.floor(latitude / SNAPSHOT_CELL) + 1000) * 100000 + Math.floor(longitude / SNAPSHOT_CELL) + 1000;
+}
+
+function parseSnapshot(text) {
+//Returns the table of a snapshot: the name, report and position of each station in columns, the row of each name,
+//and the rows in each grid cell. Lines that are not a report are skipped, and so is all of it without a header.
+  var table = { 'count': 0, 'names': [], 'reports': [], 'latitudes': [], 'longitudes': [], 'rows': {}, 'grid': {} };
+  var header = text.indexOf('raw_text,');
+  var start = text.indexOf('\n', header) + 1;
+  if ((header === -1) || (start <= 0)) return table;
+  var columns = text.slice(header, start - 1).replace(/\s+$/, '').split(',');
+  var want = [columns.indexOf('raw_text'), columns.indexOf('station_id'), columns.indexOf('latitude'),
+              columns.indexOf('longitude')];
+  var last = Math.max.apply(null, want);
+  if (want.indexOf(-1) !== -1) return table;
+
+  var fields = [];
+  while (start < text.length) {
+    var end = text.indexOf('\n', start);
+    if (end === -1) end = text.length;
+    //Only the fields up to the last one needed are cut out.
+    var at = start;
+    for (var f = 0; f <= last; f++) {
+      var comma = text.indexOf(',', at);
+      if ((comma === -1) || (comma > end)) comma = end;
+      fields[f] = text.slice(at, comma);
+      at = comma + 1;
+    }
+    start = end + 1;
+    var name = fields[want[1]], latitude = parseFloat(fields[want[2]]), longitude = parseFloat(fields[want[3]]);
+    if (!name || !fields[want[0]] || isNaN(latitude) || isNaN(longitude)) continue;
+
+    var row = table.rows.hasOwnProperty(name) ? table.rows[name] : table.count++;
+    table.rows[name] = row;
+    table.names[row] = name;
+    table.reports[row] = fields[want[0]].replace(/\s+$/, '');
+    table.latitudes[row] = latitude;
+    table.longitudes[row] = longitude;
+  }
+
+  for (var i = 0; i < table.count; i++) {
+    var cell = snapshotCell(table.latitudes[i], table.longitudes[i]);
+    (table.grid[cell] = table.grid[cell] || []).push(i);
+  }
+  return table;
+}
+
+function snapshotTable(callback) {
+//Calls callback with the current snapshot table, downloading it first if it is a publication cycle old, or with
+//null if it could not be had. Callers that come while it downloads wait for the same download, unless it has hung,
+//when they and those waiting already wait for a new one instead. After a failed download, the old table, or null,
+//is used until the retry is due, up to a publication cycle later, so an outage doesn't set off a download per request.
+  if ((snapshot.table && (Date.now() - snapshot.fetched < SNAPSHOT_REFRESH)) || (Date.now() < snapshot.retryAt)) {
+    callback(snapshot.table);
+    return;
+  }
+  if (snapshot.waiting && (Date.now() - snapshot.waiting.started < SNAPSHOT_HUNG)) {
+    snapshot.waiting.callbacks.push(callback);
+    return;
+  }
+  var waiting = snapshot.waiting = { 'callbacks': (snapshot.waiting ? snapshot.waiting.callbacks : []).concat(callback),
+                                     'started': Date.now() };
+  var fetchStarted = Date.now();
+  fetchWeb(SNAPSHOT_URL + (configuration.region ? '?region=' + encodeURIComponent(configuration.region) : ''),
+    function(req) {
+      if (snapshot.waiting !== waiting) return;
+      recordLatency('fetch', Date.now() - fetchStarted);
+      if (req.status == 200) {
+        var parseStarted = Date.now();
+        snapshot.table = parseSnapshot(req.responseText);
+        snapshot.fetched = Date.now();
+        snapshot.failures = 0;
+        snapshot.retryAt = 0;
+        recordLatency('snapshot', Date.now() - parseStarted);
+        logInfo(function() { return "Snapshot of " + snapshot.table.count + " stations."; });
+      } else {
+        logWarning(function() { return "Snapshot failed with error " + req.status; });
+        //An old snapshot is still better than asking for each station, but not for ever.
+        if (Date.now() - snapshot.fetched >= 2 * SNAPSHOT_REFRESH) snapshot.table = null;
+        snapshot.retryAt = Date.now() + Math.min(SNAPSHOT_RETRY * Math.pow(2, snapshot.failures), SNAPSHOT_REFRESH);
+        snapshot.failures++;
+      }
+      snapshot.waiting = null;
+      waiting.callbacks.forEach(function(waiter) { waiter(snapshot.table); });
+    }, false, SNAPSHOT_TIMEOUT);
+}
+
+function snapshotReport(table, station) {
+//Returns the report of a station in the snapshot, or null if it is not in it.
+  return table.rows.hasOwnProperty(station) ? table.reports[table.rows[station]] : null;
+}
+
+function snapshotNearest(table, latitude, longitude) {
+//Returns the station in the snapshot closest to a position, or null if there is none within SNAPSHOT_MAX_RING cells.
+//The cells are searched in rings out from the position's, until no closer station can be in the next ring. Distances
+//are compared in degrees of latitude, with longitude scaled down by the latitude, which is close enough for this and
+//much cheaper than distance().
+  var cellSize = SNAPSHOT_CELL, grid = table.grid, latitudes = table.latitudes, longitudes = table.longitudes;
+  var row = Math.floor(latitude / cellSize), column = Math.floor(longitude / cellSize);
+  var scale = Math.cos(toRadians(latitude));
+  var best = -1, bestSquared = Infinity;
+  for (var ring = 0; ring <= SNAPSHOT_MAX_RING; ring++) {
+    for (var r = row - ring; r <= row + ring; r++) {
+      var edge = (r === row - ring) || (r === row + ring);
+      //Only the cells on the ring: all of the top and bottom rows, and the ends of the others.
+      for (var c = column - ring; c <= column + ring; c += (edge || (ring === 0)) ? 1 : 2 * ring) {
+        var cell = grid[(r + 1000) * 100000 + c + 1000];
+        if (!cell) continue;
+        for (var i = 0; i < cell.length; i++) {
+          var dy = latitudes[cell[i]] - latitude, dx = (longitudes[cell[i]] - longitude) * scale;
+          var squared = dx * dx + dy * dy;
+          if (squared < bestSquared) {
+            bestSquared = squared;
+            best = cell[i];
+          }
+        }
+      }
+    }
+    //Anything in the next ring is at least ring cells away, and the cells east and west are scaled down.
+    var nearestNext = ring * cellSize * scale;
+    if ((best !== -1) && (nearestNext * nearestNext >= bestSquared)) break;
+  }
+  return best === -1 ? null : table.names[best];
+}
+
+function locationSuccess(pos, flight) {
 //Called on successful location lock. Requests the metar of the closest airport from geonames, giving us the 
 //station name of the closest airport. However, geonames updates the Metars slowly and sometimes gives an 
 //older, outdated metar which is why we're not using the actual metar text from geonames.
@@ -512,32 +1707,65 @@ function locationSuccess(pos) {
   var longitude = pos.coords.longitude;
     //console.log("Got position: " + latitude + "/" + longitude); //Don't log this on published app, for privacy reasons.
 
-  var response;
-  var raw_text;
-  var metar;
-//  var req = fetchWeb('http://api.geonames.org/findNearByWeatherJSON?lat=' + latitude + '&lng=' + longitude + '&radius=1000&username=olofbeckman');
-  var req = fetchWeb('http://olofbeckman.se/metar/location?lat=' + latitude + '&lon=' + longitude);
-  
-  if (req.status == 200) {
-    //I should do some validation here as well. TODO
-/*    response = JSON.parse(req.responseText);
-    raw_text = response.weatherObservation.observation;
-    metar = parseMETAR(raw_text);*/
-    if (req.responseText) {
-      //console.log("Closest station: " + metar.station);
-      sendMessage({"station": req.responseText});
-    }
-  } else {
-    console.log("Geonames failed with error " + req.status);
-    sendMessage({"net": 0});
+  var track = groundTrack(pos);
+  prefetchAhead(pos, track);
+  checkHazards(pos, track);
+
+  if (configuration.snapshot) {
+    snapshotTable(function(table) {
+      var station = table ? snapshotNearest(table, latitude, longitude) : null;
+      if (!station) {
+        lookupStation(latitude, longitude, flight);
+        return;
+      }
+      if (inFlight.location === flight) inFlight.location = null;
+      sendMessage({"station": station});
+      sendMessage(traced({"location": 0}, landFlight(flight)));
+    });
+    return;
+  }
+
+  //Along a projected track, the station is already known.
+  var ahead = stationAhead(latitude, longitude);
+  if (ahead) {
+    logInfo(function() { return "Station " + ahead + " is on the projected track."; });
+    if (inFlight.location === flight) inFlight.location = null;
+    sendMessage({"station": ahead});
+    sendMessage(traced({"location": 0}, landFlight(flight)));
+    return;
   }
-  sendMessage({"location": 0}); //Report to watch that location lookup has finished.
+
+  lookupStation(latitude, longitude, flight);
 }
 
-function locationError(err) {
+function lookupStation(latitude, longitude, flight) {
+//Asks the server for the station closest to a position, and sends it to the watch.
+//  fetchWeb('http://api.geonames.org/findNearByWeatherJSON?lat=' + latitude + '&lng=' + longitude + '&radius=1000&username=olofbeckman', ...);
+  var fetchStarted = Date.now();
+  fetchWeb(locationUrl(latitude, longitude), function(req) {
+    recordLatency('fetch', Date.now() - fetchStarted);
+    if (inFlight.location === flight) inFlight.location = null;
+    var trace = landFlight(flight);
+
+    if (req.status == 200) {
+      //I should do some validation here as well. TODO
+      if (req.responseText) {
+        sendMessage({"station": req.responseText});
+      }
+    } else {
+      logWarning(function() { return "Geonames failed with error " + req.status; });
+      sendMessage({"net": 0});
+    }
+    sendMessage(traced({"location": 0}, trace)); //Report to watch that location lookup has finished.
+  });
+}
+
+function locationError(err, flight) {
 //On failed location lookup. Report unsuccessful location to watch.
-  console.log("Error getting location.");
-  sendMessage({"location": -1, "station": configuration.station}); //Report to watch that location lookup has finished.
+  logWarning("Error getting location.");
+  if (inFlight.location === flight) inFlight.location = null;
+  var trace = landFlight(flight);
+  sendMessage(traced({"location": -1, "station": configuration.station}, trace)); //Report to watch that location lookup has finished.
 }
 
 function loadConfig() {
@@ -549,12 +1777,16 @@ function loadConfig() {
   if (!configuration) {
     configuration = BASIC_CONFIG;
   }
+  logLevel = LOG_LEVELS.hasOwnProperty(configuration.log) ? LOG_LEVELS[configuration.log] : LOG_ERROR;
 }
 
 Pebble.addEventListener("ready",
   function(e) {
-    console.log("Connected to Pebble. " + e.ready);
     loadConfig();
+    logInfo(function() { return "Connected to Pebble. " + e.ready; });
+    if (localStorage.getItem("latency")) {
+      latency = JSON.parse(localStorage.getItem("latency"));
+    }
   });
 
 //There are currently three requests possible:
@@ -565,18 +1797,30 @@ Pebble.addEventListener("ready",
 
 Pebble.addEventListener("appmessage",
   function(e) {
-    console.log("Got message from Pebble: " + describe(e.payload));
+    logDebug(function() { return "Got message from Pebble: " + describe(e.payload); });
+    if (e.payload.stats) {
+      var stats = decodeStats(e.payload.stats);
+      stats.received = Date.now();
+      logInfo(function() { return "Watch counters: " + describe(stats); });
+      localStorage.setItem("stats", JSON.stringify(stats));
+    }
+    var trace = startTrace(e.payload);
     if (e.payload.request) {
       loadConfig();
       if (e.payload.request == "location") {
-        updateLocation();
+        updateLocation(trace);
       }
       if ((e.payload.request == "metar") && (e.payload.station)) {
-        fetchMetar(e.payload.station);
+        fetchMetar(e.payload.station, trace);
         configuration.station = e.payload.station;
         localStorage.setItem("config", JSON.stringify(configuration));
       }
       if (e.payload.request == "init") {
+        //The watch forgets about push updates on init. Let it know again once the subscription answers.
+        if (subscription) subscription.active = false;
+        subscribeRefused = false;
+        //It has also forgotten the hazards.
+        hazards.sent = 0;
         var bat_save = configuration.battery ? 1 : 0;
         var largefont = configuration.largefont ? 1 : 0;
         var seconds = configuration.seconds ? 1 : 0;
@@ -593,6 +1837,7 @@ Pebble.addEventListener("showConfiguration",
     var fontstr = configuration.largefont ? 'true' : 'false';
     var secstr = configuration.seconds ? 'true' : 'false';
     var stationstr = configuration.station;
+    requestStats();
     Pebble.openURL("http://olofbeckman.se/config/application/metarconfig?version=5&seconds="+secstr+"&battery="+batstr+"&location="+gpsstr+"&station="+stationstr+"&largefont="+fontstr);
   }
 );
@@ -606,6 +1851,8 @@ Pebble.addEventListener("webviewclosed",
       configuration = JSON.parse(configjson);
       //console.log("Configuration window returned: ", JSON.stringify(configuration));
       localStorage.setItem("config", configjson);
+      //The server may take a subscription it refused before, e.g. after a change of station.
+      subscribeRefused = false;
 
       if (config_before.location != configuration.location) {      //If location has changed
         if (configuration.location) {
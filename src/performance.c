@@ -0,0 +1,64 @@
+#include "performance.h"
+
+// The standard atmosphere, with pressures in hundredths of hPa and temperatures in tenths of degrees.
+#define ISA_PRESSURE 101325
+#define ISA_TEMPERATURE 150
+#define ISA_LAPSE_RATE 198      // Tenths of degrees per 10000 ft.
+
+int32_t performance_pressure_altitude(int32_t elevation, int32_t qnh) {
+    /*
+       Returns the pressure altitude in feet of a station at elevation feet with a QNH in tenths of hPa.
+
+       The height of a pressure level in the standard atmosphere, 145366 * (1 - (p / 1013.25) ^ 0.190284) ft, is
+       approximated with 0.27303 * x + 1.1514e-6 * x^2, x being 1013.25 hPa - p in hundredths of hPa. The
+       coefficients are scaled by 2^16. Within 3 ft of the exact formula for QNH 900 to 1060 hPa.
+       */
+    if ((elevation == PERFORMANCE_UNKNOWN) || (qnh == PERFORMANCE_UNKNOWN)) {
+        return PERFORMANCE_UNKNOWN;
+    }
+    int32_t x = ISA_PRESSURE - qnh * 10;
+    return elevation + (x * 17893 + x * x * 5 / 66) / 65536;
+}
+
+int32_t performance_density_altitude(int32_t pressure_altitude, int32_t temperature) {
+    /*
+       Returns the density altitude in feet at pressure_altitude feet and temperature degrees Celsius.
+
+       The usual rule of thumb of 120 ft per degree above the standard temperature is off by hundreds of feet in
+       the cold. This fits the exact density altitude of dry air with a cubic in the deviation d from the standard
+       temperature instead: 118.750 * d - 0.26431 * d^2 + 0.00051643 * d^3 ft. Within 25 ft from -1000 to 12000 ft
+       and -40 to 50 degrees.
+       */
+    if ((pressure_altitude == PERFORMANCE_UNKNOWN) || (temperature == PERFORMANCE_UNKNOWN)) {
+        return PERFORMANCE_UNKNOWN;
+    }
+    int32_t isa = ISA_TEMPERATURE - ISA_LAPSE_RATE * pressure_altitude / 10000;
+    int32_t d = temperature * 10 - isa;
+    int32_t d2 = d * d / 100;
+    return pressure_altitude + d * 11875 / 1000 - d2 * 2643 / 10000 + d2 * d / 19363;
+}
+
+bool performance_update(Performance *performance, PerformanceInput *last, const PerformanceInput *input) {
+    /*
+       Recomputes what depends on the inputs that differ from last, and remembers them in last. Returns true if
+       any of the computed values changed.
+       */
+    Performance before = *performance;
+    bool pressure = (input->qnh != last->qnh) || (input->elevation != last->elevation);
+
+    if (pressure) {
+        performance->pressure_altitude = performance_pressure_altitude(input->elevation, input->qnh);
+    }
+    if (pressure || (input->temperature != last->temperature)) {
+        performance->density_altitude = performance_density_altitude(performance->pressure_altitude,
+            input->temperature);
+    }
+    if ((input->temperature != last->temperature) || (input->dewpoint != last->dewpoint)) {
+        performance->spread = ((input->temperature == PERFORMANCE_UNKNOWN) ||
+            (input->dewpoint == PERFORMANCE_UNKNOWN)) ? PERFORMANCE_UNKNOWN : input->temperature - input->dewpoint;
+    }
+    *last = *input;
+
+    return (before.pressure_altitude != performance->pressure_altitude) ||
+        (before.density_altitude != performance->density_altitude) || (before.spread != performance->spread);
+}
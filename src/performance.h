@@ -0,0 +1,29 @@
+/*
+   Pressure and density altitude from the temperature, dew point and QNH of a metar, in integer math only, since
+   aplite has no FPU. Plain C with no Pebble dependencies, like schedule.c.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PERFORMANCE_UNKNOWN INT32_MIN
+
+// What the phone sends. Any of them may be PERFORMANCE_UNKNOWN.
+typedef struct {
+    int32_t temperature;        // Degrees Celsius.
+    int32_t dewpoint;           // Degrees Celsius.
+    int32_t qnh;                // Tenths of hPa.
+    int32_t elevation;          // Feet, of the station.
+} PerformanceInput;
+
+// Computed values, PERFORMANCE_UNKNOWN when their inputs are.
+typedef struct {
+    int32_t pressure_altitude;  // Feet.
+    int32_t density_altitude;   // Feet.
+    int32_t spread;             // Temperature/dew point spread, degrees Celsius.
+} Performance;
+
+int32_t performance_pressure_altitude(int32_t elevation, int32_t qnh);
+int32_t performance_density_altitude(int32_t pressure_altitude, int32_t temperature);
+bool performance_update(Performance *performance, PerformanceInput *last, const PerformanceInput *input);
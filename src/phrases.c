@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include "phrases.h"
+#include "src/phrases.auto.h"       // Generated from resources/data/phrases.json by tools/phrases.py.
+
+static int readNumber(const uint8_t *data, int length, int *at, int32_t *value) {
+    /*
+       Reads a zigzag varint at *at, and moves *at past it. Returns 0 if the data ends in the middle of it.
+       */
+    uint32_t raw = 0;
+    for (int shift = 0; (*at < length) && (shift < 32); shift += 7) {
+        uint8_t byte = data[(*at)++];
+        raw |= (uint32_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = (int32_t) (raw >> 1) ^ -(int32_t) (raw & 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int phrases_render(const uint8_t *data, int length, char *text, size_t size) {
+    /*
+       Writes the text of a decoded report into text: the phrases one after the other with their numbers filled
+       in, a space between them unless a phrase starts with a newline or a comma, and the first letter of each line
+       in upper case. Stops at an unknown phrase id or a cut off number. Returns the length of the text.
+       */
+    size_t used = 0;
+    int at = 0;
+    text[0] = '\0';
+    while ((at < length) && (used + 1 < size)) {
+        uint8_t id = data[at++];
+        if (id >= PHRASE_COUNT) {
+            break;
+        }
+        int32_t args[PHRASE_MAX_ARGS] = { 0 };
+        int i;
+        for (i = 0; i < phrase_args[id]; i++) {
+            if (!readNumber(data, length, &at, &args[i])) {
+                break;
+            }
+        }
+        if (i < phrase_args[id]) {
+            break;
+        }
+
+        const char *phrase = phrase_texts[id];
+        bool line_start = (used == 0) || (text[used - 1] == '\n');
+        if (!line_start && (phrase[0] != '\n') && (phrase[0] != ',')) {
+            text[used++] = ' ';
+            text[used] = '\0';
+        }
+        // The phrases are the format, with as many %d as they take numbers.
+        int written = snprintf(text + used, size - used, phrase, (int) args[0], (int) args[1]);
+        if ((written > 0) && line_start && (text[used] >= 'a') && (text[used] <= 'z')) {
+            text[used] -= 'a' - 'A';
+        }
+        used += written > 0 ? (size_t) written : 0;
+        if (used >= size) {
+            used = size - 1;
+        }
+    }
+    return used;
+}
@@ -0,0 +1,14 @@
+/*
+   The decoded METAR view, rendered from the phrase ids and numbers the phone sends with a report, and the phrase
+   table generated from resources/data/phrases.json by tools/phrases.py. Plain C with no Pebble dependencies, like
+   runway.c.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHRASE_MAX_ARGS 2       // Numbers a phrase takes at most, as MAX_ARGS in tools/phrases.py.
+
+int phrases_render(const uint8_t *data, int length, char *text, size_t size);
@@ -0,0 +1,118 @@
+#include "runway.h"
+
+// sin(0..90 degrees) * 1024, rounded.
+static const uint16_t sine_table[91] = {
+    0, 18, 36, 54, 71, 89, 107, 125, 143, 160, 178, 195, 213,
+    230, 248, 265, 282, 299, 316, 333, 350, 367, 384, 400, 416, 433,
+    449, 465, 481, 496, 512, 527, 543, 558, 573, 587, 602, 616, 630,
+    644, 658, 672, 685, 698, 711, 724, 737, 749, 761, 773, 784, 796,
+    807, 818, 828, 839, 849, 859, 868, 878, 887, 896, 904, 912, 920,
+    928, 935, 943, 949, 956, 962, 968, 974, 979, 984, 989, 994, 998,
+    1002, 1005, 1008, 1011, 1014, 1016, 1018, 1020, 1022, 1023, 1023, 1024, 1024
+};
+
+static int32_t divideRounded(int32_t value, int32_t divisor) {
+    return (value >= 0 ? value + divisor / 2 : value - divisor / 2) / divisor;
+}
+
+int32_t runway_sin(int32_t degrees) {
+    /*
+       Returns the sine of a whole number of degrees, scaled by 1024.
+       */
+    degrees %= 360;
+    if (degrees < 0) {
+        degrees += 360;
+    }
+    if (degrees <= 90) {
+        return sine_table[degrees];
+    } else if (degrees <= 180) {
+        return sine_table[180 - degrees];
+    } else if (degrees <= 270) {
+        return -sine_table[degrees - 180];
+    }
+    return -sine_table[360 - degrees];
+}
+
+int32_t runway_cos(int32_t degrees) {
+    return runway_sin(degrees + 90);
+}
+
+void runway_components(int32_t heading, int32_t direction, int32_t speed, int32_t *headwind, int32_t *crosswind) {
+    /*
+       Splits a wind from direction at speed into its components along and across a runway heading.
+       */
+    int32_t angle = direction - heading;
+    *headwind = divideRounded(speed * runway_cos(angle), 1024);
+    *crosswind = divideRounded(speed * runway_sin(angle), 1024);
+}
+
+int runway_unpack(const uint8_t *data, int length, Runway *runways, int max, int32_t *variation) {
+    /*
+       Unpacks the magnetic variation and the runways the phone sent, three bytes each. Returns how many runways
+       there were, at most max.
+       */
+    int count = 0;
+    *variation = length > 0 ? (int8_t) data[0] : 0;
+    for (int i = 1; (i + 3 <= length) && (count < max); i += 3, count++) {
+        runways[count].heading = data[i] | (data[i + 1] << 8);
+        runways[count].suffix = data[i + 2];
+    }
+    return count;
+}
+
+static void endName(int32_t heading, char suffix, char *name) {
+    /*
+       Writes the designator of the runway end with heading, i.e. 19R, into name.
+       */
+    int number = (heading + 5) / 10 % 36;
+    if (!number) {
+        number = 36;
+    }
+    name[0] = '0' + number / 10;
+    name[1] = '0' + number % 10;
+    name[2] = suffix;
+    name[3] = '\0';
+}
+
+bool runway_best(const Runway *runways, int count, int32_t variation, int32_t direction, int32_t speed, int32_t gust,
+        RunwayWind *best) {
+    /*
+       Finds the runway end with the most headwind, and its wind components. Returns false if the wind direction
+       or speed are not known, or there are no runways. The wind direction is true, as in a metar, and is turned
+       magnetic with variation, east positive, to match the runway headings.
+       */
+    bool found = false;
+
+    if ((direction < 0) || (speed < 0)) {
+        return false;
+    }
+    direction -= variation;
+    for (int i = 0; i < count; i++) {
+        for (int end = 0; end < 2; end++) {
+            int32_t heading = end ? (runways[i].heading + 180) % 360 : runways[i].heading;
+            int32_t headwind, crosswind;
+            runway_components(heading, direction, speed, &headwind, &crosswind);
+            if (found && (headwind <= best->headwind)) {
+                continue;
+            }
+
+            // Left and right swap at the other end.
+            char suffix = runways[i].suffix;
+            if (end && (suffix == 'L')) {
+                suffix = 'R';
+            } else if (end && (suffix == 'R')) {
+                suffix = 'L';
+            }
+            endName(heading, suffix, best->name);
+            best->headwind = headwind;
+            best->crosswind = crosswind;
+            best->gusting = gust > speed;
+            if (best->gusting) {
+                int32_t gust_headwind;
+                runway_components(heading, direction, gust, &gust_headwind, &best->gust_crosswind);
+            }
+            found = true;
+        }
+    }
+    return found;
+}
@@ -0,0 +1,33 @@
+/*
+   Head and crosswind components for the runways of the station, from a sine table in integer math. Plain C with no
+   Pebble dependencies, like schedule.c.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RUNWAY_MAX 8            // Runways of a station kept on the watch. Each has two ends.
+
+// A runway as the phone sends it: three bytes, the heading of the lower numbered end (little endian) and the
+// suffix, L, R, C or 0. The runways of a station follow one signed byte of its magnetic variation.
+typedef struct {
+    uint16_t heading;           // Degrees magnetic.
+    char suffix;
+} Runway;
+
+// The wind on the runway end with the most headwind.
+typedef struct {
+    char name[4];               // Designator, i.e. 19R.
+    int32_t headwind;           // Knots, negative for a tailwind.
+    int32_t crosswind;          // Knots, positive from the right.
+    bool gusting;
+    int32_t gust_crosswind;     // Knots, in gusts.
+} RunwayWind;
+
+int32_t runway_sin(int32_t degrees);
+int32_t runway_cos(int32_t degrees);
+void runway_components(int32_t heading, int32_t direction, int32_t speed, int32_t *headwind, int32_t *crosswind);
+int runway_unpack(const uint8_t *data, int length, Runway *runways, int max, int32_t *variation);
+bool runway_best(const Runway *runways, int count, int32_t variation, int32_t direction, int32_t speed, int32_t gust,
+    RunwayWind *best);
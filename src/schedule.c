@@ -0,0 +1,220 @@
+#include "schedule.h"
+
+const SchedulePolicy schedule_default_policy = {
+    .location_interval = LOCATION_INTERVAL,
+    .high_interval = HIGH_INTERVAL,
+    .low_interval = LOW_INTERVAL,
+    .base_interval = BASE_INTERVAL,
+    .bat_save_interval = BAT_SAVE_INTERVAL,
+    .push_interval = PUSH_INTERVAL,
+    .low_treshold = LOW_TRESHOLD,
+    .high_treshold = HIGH_TRESHOLD
+};
+
+static int32_t budgetCapacity(const Schedule *schedule, int full) {
+    /*
+       Returns how many thousandths of a request can be saved up, at least two requests' worth.
+       */
+    int32_t capacity = (int32_t) schedule_budget(schedule, full) * BUDGET_BURST * 1000 / (24 * 60);
+    return capacity < 2000 ? 2000 : capacity;
+}
+
+static void budgetRefill(const Schedule *schedule, ScheduleBudget *budget, int full, time_t now) {
+    /*
+       Adds what has been saved up since the budget was last topped up, at the rate of the current charge. It is
+       called every second, when a low budget adds less than a thousandth, so what is short of one is carried over.
+       */
+    int32_t capacity = budgetCapacity(schedule, full);
+    time_t elapsed = now - budget->refilled;
+    if (elapsed > 24 * 60 * 60) {
+        elapsed = 24 * 60 * 60;
+    }
+    if (elapsed > 0) {
+        int64_t added = (int64_t) elapsed * schedule_budget(schedule, full) * 1000 + budget->remainder;
+        budget->tokens += (int32_t) (added / (24 * 60 * 60));
+        budget->remainder = (int32_t) (added % (24 * 60 * 60));
+        if (budget->tokens >= capacity) {
+            budget->tokens = capacity;
+            budget->remainder = 0;
+        }
+    }
+    budget->refilled = now;
+}
+
+static bool requestMatters(const Schedule *schedule, time_t now) {
+    /*
+       Returns true if a request now matters enough to spend the reserve on: when there is no report yet, when the
+       next one is due, when conditions are marginal or just after a tap.
+       */
+    const SchedulePolicy *policy = schedule->policy;
+    int time_since_update = (now - schedule->last_weather_update) / 60;
+    return (schedule->initial > 0) || schedule->marginal ||
+        ((time_since_update > policy->low_treshold) && (time_since_update < policy->high_treshold)) ||
+        (schedule->tapped && ((now - schedule->tapped) / 60 < BUDGET_TAP_WINDOW));
+}
+
+static bool budgetAllows(Schedule *schedule, ScheduleBudget *budget, int full, time_t now) {
+    /*
+       Returns true if the budget has a request left for a request now.
+       */
+    if (schedule->charging) {
+        return true;
+    }
+    budgetRefill(schedule, budget, full, now);
+    int32_t reserve = requestMatters(schedule, now) ? 0 :
+        budgetCapacity(schedule, full) * BUDGET_RESERVE / 100;
+    return budget->tokens >= reserve + 1000;
+}
+
+static void budgetSpend(Schedule *schedule, ScheduleBudget *budget, int full, time_t now) {
+    budgetRefill(schedule, budget, full, now);
+    if (!schedule->charging) {
+        budget->tokens -= 1000;
+    }
+}
+
+void schedule_init(Schedule *schedule, const SchedulePolicy *policy, time_t now) {
+    /*
+       Starts a schedule at now, with no reports and no location yet. The first metar is due after one interval.
+       The battery is taken to be full until told otherwise.
+       */
+    schedule->policy = policy;
+    schedule->last_weather_update = 0;
+    schedule->last_weather_check = now;
+    schedule->last_location = 0;
+    schedule->initial = 2;
+    schedule->bat_save = false;
+    schedule->push_active = false;
+    schedule->marginal = false;
+    schedule->tapped = 0;
+    schedule->charge = 100;
+    schedule->charging = false;
+    schedule->metar_budget.tokens = budgetCapacity(schedule, BUDGET_METARS);
+    schedule->metar_budget.remainder = 0;
+    schedule->metar_budget.refilled = now;
+    schedule->location_budget.tokens = budgetCapacity(schedule, BUDGET_LOCATIONS);
+    schedule->location_budget.remainder = 0;
+    schedule->location_budget.refilled = now;
+    schedule->deferred = 0;
+    schedule->deferred_at = 0;
+}
+
+void schedule_reset(Schedule *schedule) {
+    /*
+       Called when the phone has (re)connected. Polls often again until two new reports have come in.
+       */
+    schedule->initial = 2;
+    schedule->push_active = false;
+}
+
+int schedule_interval(const Schedule *schedule, time_t now) {
+    /*
+       Calculate the current interval for Metar requests in minutes.
+       */
+    const SchedulePolicy *policy = schedule->policy;
+    int result = policy->base_interval;
+    int time_since_update = (now - schedule->last_weather_update) / 60;
+
+    if (schedule->bat_save) {
+        result = policy->bat_save_interval;
+    } else {
+        if (schedule->initial == 0) {
+            if ((time_since_update > policy->low_treshold) && (time_since_update < policy->high_treshold)) {
+                result = policy->high_interval;
+            } else {
+                result = policy->low_interval;
+            }
+        }
+    }
+
+    if (schedule->push_active && (result < policy->push_interval)) {
+        result = policy->push_interval;
+    }
+
+    return result;
+}
+
+bool schedule_due(Schedule *schedule, time_t now) {
+    /*
+       Called every second by the tick handler, and on taps. Returns true if an update should be requested now,
+       and restarts the interval if so. A request that is due is held back until the budget allows it, which is
+       counted once for each minute it happens in.
+       */
+    int difference = (now - schedule->last_weather_check) / 60;
+
+    if (difference < schedule_interval(schedule, now)) {
+        return false;
+    }
+    if (!budgetAllows(schedule, &schedule->metar_budget, BUDGET_METARS, now)) {
+        if (now / 60 != schedule->deferred_at / 60) {
+            schedule->deferred++;
+        }
+        schedule->deferred_at = now;
+        return false;
+    }
+    schedule->last_weather_check = now;
+    return true;
+}
+
+ScheduleRequest schedule_request(Schedule *schedule, time_t now, bool has_station) {
+    /*
+       Returns what to ask the phone for when an update is due. The location comes first if there is no station,
+       or if it has not been updated in a while and the budget allows a GPS fix.
+       */
+    if (!schedule->last_location || !has_station) {
+        return SCHEDULE_LOCATION;
+    }
+    if (((now - schedule->last_location) / 60 > schedule->policy->location_interval) &&
+            budgetAllows(schedule, &schedule->location_budget, BUDGET_LOCATIONS, now)) {
+        return SCHEDULE_LOCATION;
+    }
+    schedule->last_weather_check = now;
+    budgetSpend(schedule, &schedule->metar_budget, BUDGET_METARS, now);
+    return SCHEDULE_METAR;
+}
+
+void schedule_location_sent(Schedule *schedule, time_t now) {
+    schedule->last_location = now;
+    budgetSpend(schedule, &schedule->location_budget, BUDGET_LOCATIONS, now);
+}
+
+void schedule_metar_received(Schedule *schedule, time_t now) {
+    /*
+       Called when a new report, i.e. one with a new issue time, has come in.
+       */
+    schedule->last_weather_update = now;
+    if (schedule->initial > 0) {
+        schedule->initial--;
+    }
+}
+
+void schedule_station_changed(Schedule *schedule) {
+    schedule->initial = 2;
+}
+
+void schedule_battery(Schedule *schedule, time_t now, int charge, bool charging) {
+    /*
+       Called when the battery charge or charging state has changed. What has been saved up so far is added at the
+       old rate.
+       */
+    budgetRefill(schedule, &schedule->metar_budget, BUDGET_METARS, now);
+    budgetRefill(schedule, &schedule->location_budget, BUDGET_LOCATIONS, now);
+    schedule->charge = charge < 0 ? 0 : (charge > 100 ? 100 : charge);
+    schedule->charging = charging;
+}
+
+void schedule_tapped(Schedule *schedule, time_t now) {
+    schedule->tapped = now;
+}
+
+int schedule_budget(const Schedule *schedule, int full) {
+    /*
+       Returns the budget per day for the current charge, of a resource with the given full budget. The budget is
+       full from BUDGET_FULL_CHARGE percent, and shrinks linearly below that to BUDGET_EMPTY_SHARE percent of it.
+       */
+    if (schedule->charging || (schedule->charge >= BUDGET_FULL_CHARGE)) {
+        return full;
+    }
+    int share = BUDGET_EMPTY_SHARE + (100 - BUDGET_EMPTY_SHARE) * schedule->charge / BUDGET_FULL_CHARGE;
+    return full * share / 100;
+}
@@ -0,0 +1,94 @@
+/*
+   Request scheduling for the watch: when to ask the phone for a new metar, and when for a new location. Plain C
+   with no Pebble dependencies, so that tools/replay.c can run the same logic on the host. tools/loadtest.js runs it
+   through a port in tools/lib/schedule.js, which needs the same changes as schedule.c.
+
+   Requests are also held to an energy budget, which shrinks with the charge of the battery. Each day has a budget
+   of metar requests and GPS fixes, saved up for at most BUDGET_BURST minutes. Requests that matter, i.e. when a
+   report is due, when conditions are marginal or after a tap, may spend all of it; others leave BUDGET_RESERVE
+   percent for them. When the budget runs low, polling slows down rather than stops.
+*/
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// Default policy, in minutes.
+#define LOCATION_INTERVAL 20
+
+#define HIGH_INTERVAL 1
+#define LOW_INTERVAL 14
+#define BASE_INTERVAL 5
+#define BAT_SAVE_INTERVAL 60
+#define PUSH_INTERVAL 30
+
+#define LOW_TRESHOLD 25
+#define HIGH_TRESHOLD 37
+
+// Energy budget.
+#define BUDGET_METARS 288           // Metar requests per day with a full budget, one every five minutes.
+#define BUDGET_LOCATIONS 72         // GPS fixes per day with a full budget, one every 20 minutes.
+#define BUDGET_FULL_CHARGE 50       // Percent charge from which the budget is full. It is also full while charging.
+#define BUDGET_EMPTY_SHARE 10       // Percent of the full budget that is left at an empty battery.
+#define BUDGET_BURST 60             // Minutes of budget that can be saved up.
+#define BUDGET_RESERVE 25           // Percent of what is saved up that only requests that matter may spend.
+#define BUDGET_TAP_WINDOW 10        // Minutes after a tap during which requests matter.
+
+// A polling policy. Metars are requested every base_interval minutes until two new reports have come in. After
+// that every low_interval minutes, except between low_treshold and high_treshold minutes after the last new
+// report, when the next one is due, and they are requested every high_interval minutes.
+typedef struct {
+    int location_interval;
+    int high_interval;
+    int low_interval;
+    int base_interval;
+    int bat_save_interval;
+    int push_interval;          // Least interval while the phone pushes new reports.
+    int low_treshold;
+    int high_treshold;
+} SchedulePolicy;
+
+typedef enum {
+    SCHEDULE_METAR,
+    SCHEDULE_LOCATION
+} ScheduleRequest;
+
+// Requests saved up for, in thousandths of a request. Below zero when requests have been made on credit.
+typedef struct {
+    int32_t tokens;
+    int32_t remainder;              // Refill short of a whole thousandth, in thousandths times seconds per day.
+    time_t refilled;                // When tokens were last topped up.
+} ScheduleBudget;
+
+typedef struct {
+    const SchedulePolicy *policy;
+    time_t last_weather_update;     // When the last new report came in.
+    time_t last_weather_check;      // When a metar was last due.
+    time_t last_location;           // When a location was last requested, 0 if never.
+    int initial;                    // New reports still to come before polling slows down.
+    bool bat_save;
+    bool push_active;               // The phone pushes new reports as they are published.
+    bool marginal;                  // Conditions are such that changes matter.
+    time_t tapped;                  // When the user last tapped the watch, 0 if never.
+    uint8_t charge;                 // Battery charge in percent.
+    bool charging;
+    ScheduleBudget metar_budget;
+    ScheduleBudget location_budget;
+    uint32_t deferred;              // Minutes that a due request has been held back by the budget.
+    time_t deferred_at;             // When a due request was last held back, 0 if never.
+} Schedule;
+
+extern const SchedulePolicy schedule_default_policy;
+
+void schedule_init(Schedule *schedule, const SchedulePolicy *policy, time_t now);
+void schedule_reset(Schedule *schedule);
+int schedule_interval(const Schedule *schedule, time_t now);
+bool schedule_due(Schedule *schedule, time_t now);
+ScheduleRequest schedule_request(Schedule *schedule, time_t now, bool has_station);
+void schedule_location_sent(Schedule *schedule, time_t now);
+void schedule_metar_received(Schedule *schedule, time_t now);
+void schedule_station_changed(Schedule *schedule);
+void schedule_battery(Schedule *schedule, time_t now, int charge, bool charging);
+void schedule_tapped(Schedule *schedule, time_t now);
+int schedule_budget(const Schedule *schedule, int full);
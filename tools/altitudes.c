@@ -0,0 +1,158 @@
+/*
+   Checks the integer pressure and density altitudes of src/performance.c against the exact formulas in floating
+   point, and times them.
+
+   Build and run on the host:
+
+       cc -O2 -Wall -Isrc -o altitudes tools/altitudes.c src/performance.c -lm
+       ./altitudes [--iterations N]
+
+   The pressure altitude is checked for every QNH from 900 to 1060 hPa in tenths, and the density altitude for
+   every pressure altitude from -1000 to 12000 ft in steps of 10 ft and every temperature from -40 to 50 degrees.
+   These are the ranges the comments in performance.c give their error bounds for, and the run fails if the worst
+   error found is outside them. The timing loop runs both functions over the same inputs --iterations times, and
+   the floating point formulas likewise for comparison. Times on the host are only good for comparing the two.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "performance.h"
+
+#define PRESSURE_TOLERANCE 3        // Feet, as documented on performance_pressure_altitude.
+#define DENSITY_TOLERANCE 25        // Feet, as documented on performance_density_altitude.
+
+#define QNH_LOWEST 9000             // Tenths of hPa.
+#define QNH_HIGHEST 10600
+#define ALTITUDE_LOWEST -1000       // Feet.
+#define ALTITUDE_HIGHEST 12000
+#define ALTITUDE_STEP 10
+#define TEMPERATURE_LOWEST -40      // Degrees Celsius.
+#define TEMPERATURE_HIGHEST 50
+
+// The standard atmosphere, in the form aviation references give it.
+#define ISA_PRESSURE_HPA 1013.25
+#define ISA_TEMPERATURE_K 288.15
+#define PRESSURE_SCALE_FT 145366.45
+#define PRESSURE_EXPONENT 0.190284
+#define DENSITY_SCALE_FT 145442.16
+#define DENSITY_EXPONENT 0.234969
+
+static volatile int32_t sink;
+static volatile double float_sink;
+
+static double exact_pressure_altitude(double qnh) {
+    /*
+       Returns the height in feet of the pressure level qnh hPa in the standard atmosphere.
+       */
+    return PRESSURE_SCALE_FT * (1 - pow(qnh / ISA_PRESSURE_HPA, PRESSURE_EXPONENT));
+}
+
+static double exact_density_altitude(double pressure_altitude, double temperature) {
+    /*
+       Returns the height in feet in the standard atmosphere with the density of dry air at pressure_altitude feet
+       and temperature degrees Celsius.
+       */
+    double pressure_ratio = pow(1 - pressure_altitude / PRESSURE_SCALE_FT, 1 / PRESSURE_EXPONENT);
+    double density_ratio = pressure_ratio * ISA_TEMPERATURE_K / (temperature + 273.15);
+    return DENSITY_SCALE_FT * (1 - pow(density_ratio, DENSITY_EXPONENT));
+}
+
+static bool check_pressure(void) {
+    /*
+       Prints the worst error of performance_pressure_altitude, and returns whether it is within tolerance.
+       */
+    double worst = 0;
+    int32_t worst_qnh = QNH_LOWEST;
+    for (int32_t qnh = QNH_LOWEST; qnh <= QNH_HIGHEST; qnh++) {
+        double error = performance_pressure_altitude(0, qnh) - exact_pressure_altitude(qnh / 10.0);
+        if (fabs(error) > fabs(worst)) {
+            worst = error;
+            worst_qnh = qnh;
+        }
+    }
+    printf("pressure altitude  worst error %+6.1f ft at QNH %d.%d hPa (tolerance %d ft)\n", worst,
+        (int) (worst_qnh / 10), (int) (worst_qnh % 10), PRESSURE_TOLERANCE);
+    return fabs(worst) <= PRESSURE_TOLERANCE;
+}
+
+static bool check_density(void) {
+    /*
+       Prints the worst error of performance_density_altitude, and returns whether it is within tolerance.
+       */
+    double worst = 0;
+    int32_t worst_altitude = ALTITUDE_LOWEST;
+    int32_t worst_temperature = TEMPERATURE_LOWEST;
+    for (int32_t altitude = ALTITUDE_LOWEST; altitude <= ALTITUDE_HIGHEST; altitude += ALTITUDE_STEP) {
+        for (int32_t temperature = TEMPERATURE_LOWEST; temperature <= TEMPERATURE_HIGHEST; temperature++) {
+            double error = performance_density_altitude(altitude, temperature) -
+                exact_density_altitude(altitude, temperature);
+            if (fabs(error) > fabs(worst)) {
+                worst = error;
+                worst_altitude = altitude;
+                worst_temperature = temperature;
+            }
+        }
+    }
+    printf("density altitude   worst error %+6.1f ft at %d ft and %d degrees (tolerance %d ft)\n", worst,
+        (int) worst_altitude, (int) worst_temperature, DENSITY_TOLERANCE);
+    return fabs(worst) <= DENSITY_TOLERANCE;
+}
+
+static double seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void time_calls(long iterations) {
+    /*
+       Times a pressure and a density altitude per input, with the integer and the floating point formulas.
+       */
+    long calls = iterations * (QNH_HIGHEST - QNH_LOWEST + 1);
+
+    double started = seconds();
+    for (long i = 0; i < iterations; i++) {
+        for (int32_t qnh = QNH_LOWEST; qnh <= QNH_HIGHEST; qnh++) {
+            int32_t pressure_altitude = performance_pressure_altitude((int32_t) i % 1000, qnh);
+            sink = performance_density_altitude(pressure_altitude, qnh % 91 - 40);
+        }
+    }
+    double integer = (seconds() - started) / calls * 1e9;
+
+    started = seconds();
+    for (long i = 0; i < iterations; i++) {
+        for (int32_t qnh = QNH_LOWEST; qnh <= QNH_HIGHEST; qnh++) {
+            double pressure_altitude = i % 1000 + exact_pressure_altitude(qnh / 10.0);
+            float_sink = exact_density_altitude(pressure_altitude, qnh % 91 - 40);
+        }
+    }
+    double exact = (seconds() - started) / calls * 1e9;
+
+    printf("\n%ld calls of each\n", calls);
+    printf("integer            %6.1f ns per pressure and density altitude\n", integer);
+    printf("floating point     %6.1f ns per pressure and density altitude\n", exact);
+}
+
+int main(int argc, char **argv) {
+    long iterations = 2000;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--iterations") && (i + 1 < argc)) {
+            iterations = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    bool pressure = check_pressure();
+    bool density = check_density();
+    time_calls(iterations);
+
+    if (!pressure || !density) {
+        printf("\nOutside the documented tolerance.\n");
+        return 1;
+    }
+    return 0;
+}
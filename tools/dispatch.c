@@ -0,0 +1,289 @@
+/*
+   Benchmarks how the watch reads incoming app messages: one dict_find per key of the schema, as the handler used to,
+   against a single pass with message_read from the generated schema (src/message_schema.auto.h). The dictionary
+   functions below work like the ones in the Pebble firmware, on the same layout, so the number of tuples visited is
+   the same as on the watch. Times on the host are only good for comparing the two.
+
+   Build and run on the host:
+
+       mkdir -p build/src && python tools/schema.py c > build/src/message_schema.auto.h
+       cc -O2 -Wall -Ibuild -o dispatch tools/dispatch.c
+       ./dispatch [--iterations N] [--padding N]
+
+   The messages are the ones the companion app sends: the init reply, a station, a full metar report, and one with
+   every key of the schema. Both readers and the last message take their keys from message_types, so they keep up
+   as keys are added. --padding adds tuples with keys the watch does not know to each of them, to see how both ways scale
+   with the size of a message.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+// Dictionaries as in the Pebble SDK. {{{
+typedef enum {
+    TUPLE_BYTE_ARRAY = 0,
+    TUPLE_CSTRING = 1,
+    TUPLE_UINT = 2,
+    TUPLE_INT = 3
+} TupleType;
+
+typedef struct __attribute__((__packed__)) {
+    uint32_t key;
+    TupleType type:8;
+    uint16_t length;
+    union {
+        uint8_t data[0];
+        char cstring[0];
+        uint8_t uint8;
+        uint16_t uint16;
+        uint32_t uint32;
+        int8_t int8;
+        int16_t int16;
+        int32_t int32;
+    } value[];
+} Tuple;
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t count;
+    Tuple head[];
+} Dictionary;
+
+typedef struct {
+    Dictionary *dictionary;
+    const void *end;
+    Tuple *cursor;
+} DictionaryIterator;
+
+static long tuples_visited = 0;
+
+static Tuple *dict_read_next(DictionaryIterator *iter) {
+    Tuple *next = (Tuple *) ((uint8_t *) iter->cursor + sizeof(Tuple) + iter->cursor->length);
+    if ((const void *) next >= iter->end) {
+        return NULL;
+    }
+    iter->cursor = next;
+    tuples_visited++;
+    return next;
+}
+
+static Tuple *dict_read_first(DictionaryIterator *iter) {
+    if (!iter->dictionary->count) {
+        return NULL;
+    }
+    iter->cursor = iter->dictionary->head;
+    tuples_visited++;
+    return iter->cursor;
+}
+
+static Tuple *dict_find(DictionaryIterator *iter, uint32_t key) {
+    for (Tuple *tuple = dict_read_first(iter); tuple; tuple = dict_read_next(iter)) {
+        if (tuple->key == key) {
+            return tuple;
+        }
+    }
+    return NULL;
+}
+// }}}
+
+#include "src/message_schema.auto.h"
+
+#define MAX_MESSAGE 1024
+#define PADDING_KEY 0x1000
+
+typedef struct {
+    const char *name;
+    uint8_t buffer[MAX_MESSAGE];
+    DictionaryIterator iter;
+} TestMessage;
+
+static void begin(TestMessage *message, const char *name) {
+    message->name = name;
+    message->iter.dictionary = (Dictionary *) message->buffer;
+    message->iter.dictionary->count = 0;
+    message->iter.end = message->iter.dictionary->head;
+}
+
+static void writeTuple(TestMessage *message, uint32_t key, TupleType type, const void *data, uint16_t length) {
+    Tuple *tuple = (Tuple *) message->iter.end;
+    if ((uint8_t *) tuple + sizeof(Tuple) + length > message->buffer + MAX_MESSAGE) {
+        fprintf(stderr, "Message %s is too large.\n", message->name);
+        exit(1);
+    }
+    tuple->key = key;
+    tuple->type = type;
+    tuple->length = length;
+    memcpy(tuple->value->data, data, length);
+    message->iter.dictionary->count++;
+    message->iter.end = (uint8_t *) tuple + sizeof(Tuple) + length;
+}
+
+static void writeInt(TestMessage *message, uint32_t key, int32_t value) {
+    // The phone sends integers with the least width that holds them, like PebbleKit JS does.
+    if ((value >= INT8_MIN) && (value <= INT8_MAX)) {
+        int8_t narrow = value;
+        writeTuple(message, key, TUPLE_INT, &narrow, 1);
+    } else if ((value >= INT16_MIN) && (value <= INT16_MAX)) {
+        int16_t narrow = value;
+        writeTuple(message, key, TUPLE_INT, &narrow, 2);
+    } else {
+        writeTuple(message, key, TUPLE_INT, &value, 4);
+    }
+}
+
+static void writeString(TestMessage *message, uint32_t key, const char *value) {
+    writeTuple(message, key, TUPLE_CSTRING, value, strlen(value) + 1);
+}
+
+static void writePadding(TestMessage *message, int padding) {
+    for (int i = 0; i < padding; i++) {
+        writeInt(message, PADDING_KEY + i, i);
+    }
+}
+
+static void writeMetar(TestMessage *message) {
+    static const uint8_t runways[] = { 7, 0x0a, 0x00, 'L', 0x0a, 0x00, 'R', 0x17, 0x00, 0 };
+    static const uint8_t phrases[] = { 2, 42, 24, 0, 7, 0xa0, 0x9c, 0x01, 0, 15, 10, 80, 0, 12, 24, 13, 14 };
+    writeString(message, METAR_KEY, "ESSA 181120Z 21012G24KT 9999 FEW025 BKN040 12/07 Q1009 NOSIG");
+    writeInt(message, UPDATED_KEY, 1760785200);
+    writeInt(message, CATEGORY_KEY, 0);
+    writeInt(message, CEILING_KEY, 4000);
+    writeInt(message, VISIBILITY_KEY, 9999);
+    writeInt(message, WIND_KEY, 12);
+    writeInt(message, WX_KEY, 0);
+    writeInt(message, TEMPERATURE_KEY, 12);
+    writeInt(message, DEWPOINT_KEY, 7);
+    writeInt(message, QNH_KEY, 10090);
+    writeInt(message, ELEVATION_KEY, 137);
+    writeTuple(message, RUNWAYS_KEY, TUPLE_BYTE_ARRAY, runways, sizeof(runways));
+    writeInt(message, WINDDIR_KEY, 210);
+    writeInt(message, GUST_KEY, 24);
+    writeTuple(message, PHRASES_KEY, TUPLE_BYTE_ARRAY, phrases, sizeof(phrases));
+    writeInt(message, TRACE_KEY, 42);
+}
+
+static void writeEveryKey(TestMessage *message) {
+    /*
+       Writes a tuple of the accepted type for every key of the schema.
+       */
+    static const uint8_t bytes[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    for (uint32_t key = 0; key < MESSAGE_SLOTS; key++) {
+        if (message_types[key] == MESSAGE_TYPE_CSTRING) {
+            writeString(message, key, "ESSA");
+        } else if (message_types[key] == MESSAGE_TYPE_BYTES) {
+            writeTuple(message, key, TUPLE_BYTE_ARRAY, bytes, sizeof(bytes));
+        } else if (message_types[key] == MESSAGE_TYPE_INTEGER) {
+            writeInt(message, key, 1);
+        }
+    }
+}
+
+// What the handler reads, in the same order, summed so that the compiler keeps it. {{{
+static uint32_t readLookups(DictionaryIterator *received) {
+    /*
+       The handler as it was, with a dict_find for each key. The keys are those of the schema, so that both ways
+       look for the same ones as keys are added.
+       */
+    uint32_t sum = 0;
+    for (uint32_t key = 0; key < MESSAGE_SLOTS; key++) {
+        if (message_types[key] == MESSAGE_TYPE_NONE) {
+            continue;
+        }
+        Tuple *tuple = dict_find(received, key);
+        if (tuple) {
+            sum += tuple->length;
+        }
+    }
+    return sum;
+}
+
+static uint32_t readMessage(DictionaryIterator *received) {
+    /*
+       The handler as it is, with one pass of message_read and the generated accessors.
+       */
+    Message message;
+    message_read(received, &message);
+    uint32_t sum = message.unknown;
+    for (uint32_t key = 0; key < MESSAGE_SLOTS; key++) {
+        if (message_has(&message, key)) {
+            sum += message.tuples[key]->length;
+        }
+    }
+    return sum;
+}
+// }}}
+
+static double nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+static void bench(TestMessage *message, long iterations) {
+    uint32_t (*readers[])(DictionaryIterator *) = { readLookups, readMessage };
+    double ns[2];
+    double visited[2];
+    uint32_t sums[2];
+    for (int r = 0; r < 2; r++) {
+        sums[r] = 0;
+        tuples_visited = 0;
+        double started = nowNs();
+        for (long i = 0; i < iterations; i++) {
+            sums[r] += readers[r](&message->iter);
+        }
+        ns[r] = (nowNs() - started) / iterations;
+        visited[r] = (double) tuples_visited / iterations;
+    }
+    printf("%-10s %5d %6d %12.0f %8.1f %12.0f %8.1f %7.1fx\n", message->name, message->iter.dictionary->count,
+        (int) ((const uint8_t *) message->iter.end - message->buffer), visited[0], ns[0], visited[1], ns[1],
+        ns[0] / ns[1]);
+    if (sums[0] == 0) {
+        printf("(%u %u)\n", sums[0], sums[1]);     // Never, but keeps the sums alive.
+    }
+}
+
+int main(int argc, char **argv) {
+    long iterations = 1000000;
+    int padding = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--iterations") && (i + 1 < argc)) {
+            iterations = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--padding") && (i + 1 < argc)) {
+            padding = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--iterations N] [--padding N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    static TestMessage messages[4];
+    begin(&messages[0], "init");
+    writeInt(&messages[0], INIT_KEY, 1);
+    writeInt(&messages[0], SECONDS_KEY, 1);
+    writeInt(&messages[0], BAT_KEY, 0);
+    writeInt(&messages[0], LARGEFONT_KEY, 0);
+    writePadding(&messages[0], padding);
+
+    begin(&messages[1], "station");
+    writeString(&messages[1], STATION_KEY, "ESSA");
+    writePadding(&messages[1], padding);
+
+    begin(&messages[2], "metar");
+    writeMetar(&messages[2]);
+    writePadding(&messages[2], padding);
+
+    begin(&messages[3], "all keys");
+    writeEveryKey(&messages[3]);
+    writePadding(&messages[3], padding);
+
+    printf("%ld iterations, %d unknown keys added to each message.\n\n", iterations, padding);
+    printf("%-10s %5s %6s %12s %8s %12s %8s %8s\n", "message", "keys", "bytes", "dict_find", "ns", "one pass",
+        "ns", "speedup");
+    printf("%-10s %5s %6s %12s %8s %12s %8s\n", "", "", "", "(visited)", "", "(visited)", "");
+    for (int i = 0; i < 4; i++) {
+        bench(&messages[i], iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,494 @@
+#!/usr/bin/env node
+// Runs the companion app (src/js/pebble-js-app.js) on the host, against the stand-in METAR server in
+// tools/lib/metar-server.js, and records every message it sends to the watch with its size and timing.
+//
+// Usage: node tools/harness.js trace [--station NAME] [--log LEVEL]
+//        node tools/harness.js bench [--updates N] [--save FILE] [--compare FILE] [NAME ...]
+//        node tools/harness.js snapshot [--stations N] [--updates N]
+//
+// trace plays a short session (ready, init, a location and a metar request, and a configuration change) and prints
+// what the app sends. bench runs the benchmarks named, or all of them, and reports messages, bytes and wall time per
+// update. --save writes the results as JSON, and --compare checks them against such a file: more messages or bytes
+// per update, or more than COMPARE_SLACK more wall time, fail the run. snapshot reports the size of a regional
+// snapshot of N stations, and how long the app takes to decode it, how much memory the table takes, and how long a
+// nearest station lookup in it takes.
+//
+// Everything runs in one event queue that the harness drains, so wall times are those of the app alone, with no
+// network and no waiting on timers.
+
+var env = require('./lib/pebble-env');
+var MetarServer = require('./lib/metar-server');
+var fs = require('fs');
+var v8 = require('v8');
+var vm = require('vm');
+var zlib = require('zlib');
+
+var COMPARE_SLACK = 0.25;       // Share of wall time an update may grow by before --compare fails.
+var WARMUP = 200;               // Updates run before timing starts, for the JIT to settle.
+var TUPLE_HEADER = 7;           // Key, type and length of each tuple in an AppMessage dictionary.
+var HAZARD_POLYGONS = 500;      // Hazards in force in the hazard benchmarks.
+var HAZARD_CHECKS = 20;         // Fixes checked per update in the hazard-index and hazard-scan benchmarks.
+var SNAPSHOT_STATIONS = 3000;   // Stations in the region of the snapshot benchmarks.
+
+function valueSize(value) {
+//Returns the size of a value in an AppMessage, as PebbleKit JS sends it.
+    if (typeof value === 'string') return Buffer.byteLength(value, 'utf8') + 1;
+    if (Array.isArray(value)) return value.length;
+    return 4;
+}
+
+function messageSize(payload) {
+//Returns the size of the AppMessage dictionary a payload is sent as.
+    return 1 + Object.keys(payload).reduce(function(size, key) {
+        return size + TUPLE_HEADER + valueSize(payload[key]);
+    }, 0);
+}
+
+function Harness(options) {
+//The companion app in a sandbox, with a METAR server, a position, and a record of what it sends. options.config is
+//its stored configuration, and options.hazards the number of hazards the server has. The position has a heading
+//and a speed when they are set.
+    var harness = this;
+    options = options || {};
+    this.queue = [];
+    this.timers = [];
+    this.sent = [];
+    this.logs = [];
+    this.latitude = options.latitude !== undefined ? options.latitude : 59.65;
+    this.longitude = options.longitude !== undefined ? options.longitude : 17.92;
+    this.heading = options.heading;
+    this.speed = options.speed;
+    this.server = options.server || new MetarServer({ stations: options.stations || 200, hazards: options.hazards });
+    this.now = this.server.now;
+    this.started = process.hrtime();
+    this.eventStarted = 0;
+
+    this.app = env.createEnvironment({
+        now: function() {
+            return harness.now;
+        },
+        console: {
+            log: function(message) {
+                harness.logs.push(message);
+                if (options.echo) console.log('  log: ' + message);
+            }
+        },
+        XMLHttpRequest: env.createXMLHttpRequest(function(method, url, respond) {
+            return harness.server.handle(method, url, respond);
+        }, function(callback) {
+            harness.defer(callback);
+        }),
+        setTimeout: function(callback, ms) {
+            var timer = { due: harness.now + ms, callback: callback };
+            harness.timers.push(timer);
+            return timer;
+        },
+        clearTimeout: function(timer) {
+            var i = harness.timers.indexOf(timer);
+            if (i !== -1) harness.timers.splice(i, 1);
+        },
+        geolocation: {
+            getCurrentPosition: function(success) {
+                harness.defer(function() {
+                    success({ coords: { latitude: harness.latitude, longitude: harness.longitude,
+                        heading: harness.heading, speed: harness.speed }, timestamp: harness.now });
+                });
+            }
+        },
+        sendAppMessage: function(payload, success) {
+            harness.record(payload);
+            harness.defer(function() {
+                success({ data: { transactionId: harness.sent.length } });
+            });
+        }
+    });
+    this.app.localStorage.setItem('config', JSON.stringify(options.config || { 'location': true }));
+}
+
+Harness.prototype.defer = function(callback) {
+    this.queue.push(callback);
+};
+
+Harness.prototype.elapsed = function() {
+//Returns the wall time since the harness was created, in ms.
+    var t = process.hrtime(this.started);
+    return t[0] * 1000 + t[1] / 1e6;
+};
+
+Harness.prototype.record = function(payload) {
+//Keeps a copy of a message to the watch, with when it was sent after the start of the event, its size, and whether
+//the watch knows all its keys.
+    var keys = this.app.MESSAGE_KEYS;
+    this.sent.push({
+        at: this.elapsed() - this.eventStarted,
+        payload: JSON.parse(JSON.stringify(payload)),
+        bytes: messageSize(payload),
+        unknown: keys ? Object.keys(payload).filter(function(key) { return !keys.hasOwnProperty(key); }) : []
+    });
+};
+
+Harness.prototype.drain = function() {
+//Runs the queue until the app has nothing more to do.
+    while (this.queue.length) {
+        this.queue.shift()();
+    }
+};
+
+Harness.prototype.advance = function(minutes) {
+//Moves the clock of the server and the app's timers on, and runs whatever becomes due.
+    var harness = this;
+    this.now += minutes * 60000;
+    this.server.setTime(this.now);
+    var due = this.timers.filter(function(timer) { return timer.due <= harness.now; });
+    this.timers = this.timers.filter(function(timer) { return timer.due > harness.now; });
+    due.forEach(function(timer) { timer.callback(); });
+    this.drain();
+};
+
+Harness.prototype.emit = function(name, event) {
+//Sends an event to the app, and runs it to completion. Returns the messages it sent.
+    var first = this.sent.length;
+    this.eventStarted = this.elapsed();
+    this.app.emit(name, event);
+    this.drain();
+    return this.sent.slice(first);
+};
+
+Harness.prototype.ready = function() {
+    return this.emit('ready', { ready: true });
+};
+
+Harness.prototype.appMessage = function(payload) {
+    return this.emit('appmessage', { payload: payload });
+};
+
+Harness.prototype.webviewClosed = function(config) {
+    return this.emit('webviewclosed', { response: encodeURIComponent(JSON.stringify(config)) });
+};
+
+function scanHazards(app, latitude, longitude, track, now) {
+//Returns the hazard summary of a fix as the app's hazardSummary does, but by testing every hazard in turn instead of
+//searching the R-tree, to compare against.
+    var here = 0, ahead = 0, entry = -1;
+    var p = [longitude, latitude];
+    var end = app.project(latitude, longitude, track.heading, track.speed * app.HAZARD_HORIZON * 60);
+    var q = [end.longitude, end.latitude];
+    app.hazards.items.forEach(function(hazard) {
+        if (hazard.to <= now) return;
+        if (app.pointInPolygon(p, hazard.ring)) {
+            if (hazard.from <= now) here |= hazard.flags;
+            return;
+        }
+        var t = app.segmentEntry(p, q, hazard.ring);
+        if ((t < 0) || (hazard.from > now + t * app.HAZARD_HORIZON * 60000)) return;
+        ahead |= hazard.flags;
+        if ((entry < 0) || (t < entry)) entry = t;
+    });
+    var minutes = entry < 0 ? 0 : Math.min(255, Math.max(1, Math.ceil(entry * app.HAZARD_HORIZON)));
+    return here | (ahead << 8) | (minutes << 16);
+}
+
+function checkHazards(harness, i, summary) {
+//Checks HAZARD_CHECKS fixes spread over the area of the stations with summary. Returns no messages, as it sends none.
+    var track = { heading: (i * 37) % 360, speed: 60 };
+    var result = 0;
+    for (var c = 0; c < HAZARD_CHECKS; c++) {
+        var n = i * HAZARD_CHECKS + c;
+        result ^= summary(harness.app, 55 + (n * 0.0137) % 14, 11 + (n * 0.0291) % 13, track, harness.now);
+    }
+    harness.checksum = (harness.checksum || 0) ^ result;
+    return [];
+}
+
+function locateAndFetch(harness, i) {
+//Moves the phone north over the stations, ten minutes on, and has the watch ask for its location and then for the
+//metar of the station it was given. The location and snapshot benchmarks share this, so they compare like for like.
+    harness.advance(10);
+    harness.latitude = 55 + (i % 280) * 0.05;
+    var sent = harness.appMessage({ 'request': 'location', 'trace': i + 1 });
+    var station = sent.filter(function(message) { return message.payload.station; }).pop();
+    if (station) {
+        sent = sent.concat(harness.appMessage({ 'request': 'metar', 'station': station.payload.station }));
+    }
+    return sent;
+}
+
+function loadHazards(harness) {
+//Has the app fetch and index the hazards, with a location request from a moving position.
+    harness.heading = 0;
+    harness.speed = 60;
+    harness.appMessage({ 'request': 'location' });
+}
+
+// Benchmarks. Each runs a number of updates on a fresh harness, and returns the messages it sent during them.
+var BENCHMARKS = {
+    'metar': {
+        description: 'a metar request for the current station, with a new report each time',
+        config: { 'location': false, 'push': false, 'station': 'XAAA' },
+        update: function(harness, i) {
+            harness.advance(30);
+            return harness.appMessage({ 'request': 'metar', 'station': 'XAAA', 'trace': i + 1 });
+        }
+    },
+    'location': {
+        description: 'a location request, the station lookup, and the metar request that follows it, among ' +
+            SNAPSHOT_STATIONS + ' stations',
+        config: { 'location': true, 'push': false },
+        stations: SNAPSHOT_STATIONS,
+        update: locateAndFetch
+    },
+    'push': {
+        description: 'a new report pushed over the subscription',
+        config: { 'location': false, 'push': true, 'station': 'XAAA' },
+        setup: function(harness) {
+            harness.appMessage({ 'request': 'metar', 'station': 'XAAA' });
+        },
+        update: function(harness) {
+            var first = harness.sent.length;
+            harness.advance(30);
+            return harness.sent.slice(first);
+        }
+    },
+    'hazards': {
+        description: 'a location request while flying north at 60 m/s, checked against ' + HAZARD_POLYGONS +
+            ' hazards',
+        config: { 'location': true, 'push': false, 'prefetch': false },
+        hazards: HAZARD_POLYGONS,
+        setup: loadHazards,
+        update: function(harness, i) {
+            harness.advance(5);
+            harness.latitude = 55 + (i % 1400) * 0.01;     // 18 km in 5 minutes, a share of it to keep on the grid.
+            return harness.appMessage({ 'request': 'location', 'trace': i + 1 });
+        }
+    },
+    'hazard-index': {
+        description: HAZARD_CHECKS + ' fixes and tracks checked against ' + HAZARD_POLYGONS +
+            ' hazards, with the R-tree',
+        config: { 'location': true, 'push': false, 'prefetch': false },
+        hazards: HAZARD_POLYGONS,
+        setup: loadHazards,
+        update: function(harness, i) {
+            return checkHazards(harness, i, function(app, latitude, longitude, track, now) {
+                return app.hazardSummary(latitude, longitude, track, now);
+            });
+        }
+    },
+    'hazard-scan': {
+        description: 'the same, testing every hazard',
+        config: { 'location': true, 'push': false, 'prefetch': false },
+        hazards: HAZARD_POLYGONS,
+        setup: loadHazards,
+        update: function(harness, i) {
+            return checkHazards(harness, i, scanHazards);
+        }
+    },
+    'snapshot': {
+        description: 'the same, answered from a snapshot of the stations, downloaded every third update',
+        config: { 'location': true, 'push': false, 'snapshot': true },
+        stations: SNAPSHOT_STATIONS,
+        update: locateAndFetch
+    },
+    'init': {
+        description: 'an init request',
+        config: { 'location': true, 'seconds': true },
+        update: function(harness) {
+            return harness.appMessage({ 'request': 'init' });
+        }
+    }
+};
+
+function runBenchmark(name, updates) {
+//Returns messages, bytes and wall time per update of a benchmark.
+    var benchmark = BENCHMARKS[name];
+    if (!benchmark) throw new Error('Unknown benchmark ' + name);
+    var harness = new Harness({ config: benchmark.config, hazards: benchmark.hazards || 0,
+        stations: benchmark.stations });
+    harness.ready();
+    if (benchmark.setup) benchmark.setup(harness);
+
+    for (var i = 0; i < WARMUP; i++) {
+        benchmark.update(harness, i);
+    }
+
+    var messages = 0, bytes = 0, unknown = 0, wall = 0;
+    for (i = WARMUP; i < WARMUP + updates; i++) {
+        var started = harness.elapsed();
+        var sent = benchmark.update(harness, i);
+        wall += harness.elapsed() - started;
+        messages += sent.length;
+        sent.forEach(function(message) {
+            bytes += message.bytes;
+            unknown += message.unknown.length;
+        });
+    }
+    return {
+        messages: Math.round(messages / updates * 10) / 10,
+        bytes: Math.round(bytes / updates * 10) / 10,
+        ms: wall / updates,
+        unknownKeys: unknown
+    };
+}
+
+function compare(results, baseline) {
+//Returns the regressions of results against a baseline, as strings.
+    var regressions = [];
+    Object.keys(results).forEach(function(name) {
+        var now = results[name], before = baseline[name];
+        if (!before) return;
+        if (now.messages > before.messages) {
+            regressions.push(name + ': ' + now.messages + ' messages per update, was ' + before.messages);
+        }
+        if (now.bytes > before.bytes) {
+            regressions.push(name + ': ' + now.bytes + ' bytes per update, was ' + before.bytes);
+        }
+        if (now.ms > before.ms * (1 + COMPARE_SLACK)) {
+            regressions.push(name + ': ' + now.ms.toFixed(3) + ' ms per update, was ' + before.ms.toFixed(3));
+        }
+    });
+    return regressions;
+}
+
+function trace(args) {
+//Plays a short session, and prints what the app sends for each event.
+    var harness = new Harness({ config: { 'location': true, 'log': args.log }, echo: !!args.log });
+    var station = args.station;
+
+    function show(title, sent) {
+        console.log(title);
+        sent.forEach(function(message) {
+            console.log('  +' + message.at.toFixed(2) + ' ms ' + message.bytes + ' B ' + JSON.stringify(message.payload) +
+                (message.unknown.length ? ' (unknown keys: ' + message.unknown.join(', ') + ')' : ''));
+        });
+    }
+
+    show('ready', harness.ready());
+    show('appmessage init', harness.appMessage({ 'request': 'init' }));
+    var located = harness.appMessage({ 'request': 'location', 'trace': 1 });
+    show('appmessage location', located);
+    located.forEach(function(message) {
+        if (!station && message.payload.station) station = message.payload.station;
+    });
+    show('appmessage metar ' + station, harness.appMessage({ 'request': 'metar', 'station': station, 'trace': 2 }));
+    show('webviewclosed', harness.webviewClosed({ 'location': false, 'station': station, 'seconds': true,
+        'largefont': true, 'battery': false }));
+}
+
+function bench(args) {
+    var names = args.names.length ? args.names : Object.keys(BENCHMARKS);
+    var results = {};
+    console.log(args.updates + ' updates each.\n');
+    console.log('benchmark     messages     bytes   ms/update');
+    names.forEach(function(name) {
+        var result = results[name] = runBenchmark(name, args.updates);
+        console.log((name + '            ').slice(0, 12) + ('          ' + result.messages.toFixed(1)).slice(-10) +
+            ('          ' + result.bytes.toFixed(1)).slice(-10) + ('            ' + result.ms.toFixed(3)).slice(-12) +
+            '   ' + BENCHMARKS[name].description +
+            (result.unknownKeys ? ' (' + result.unknownKeys + ' unknown keys sent!)' : ''));
+    });
+
+    if (args.save) {
+        fs.writeFileSync(args.save, JSON.stringify(results, null, 2) + '\n');
+    }
+    if (args.compare) {
+        var regressions = compare(results, JSON.parse(fs.readFileSync(args.compare, 'utf8')));
+        if (regressions.length) {
+            console.log('\nRegressions against ' + args.compare + ':');
+            regressions.forEach(function(regression) { console.log('  ' + regression); });
+            process.exitCode = 1;
+        } else {
+            console.log('\nNo regressions against ' + args.compare + '.');
+        }
+    }
+}
+
+function collectGarbage() {
+//Runs a full garbage collection, so that heap sizes only count what is still referenced.
+    v8.setFlagsFromString('--expose-gc');
+    vm.runInNewContext('gc')();
+}
+
+function snapshotBench(args) {
+//Decodes a snapshot of args.stations stations args.updates times, and reports its size, the decode time, the memory
+//a table takes, and the time of a nearest station lookup.
+    var stations = args.stations || SNAPSHOT_STATIONS;
+    var server = new MetarServer({ stations: stations, hazards: 0, south: 35, north: 71, west: -10, east: 40 });
+    var csv = server.snapshot();
+    var app = new Harness({ server: server }).app;
+    var runs = Math.max(1, Math.round(args.updates / 100));
+
+    for (var i = 0; i < WARMUP / 20; i++) app.parseSnapshot(csv);
+    var started = process.hrtime();
+    var table;
+    for (i = 0; i < runs; i++) table = app.parseSnapshot(csv);
+    var t = process.hrtime(started);
+    var decodeMs = (t[0] * 1000 + t[1] / 1e6) / runs;
+
+    table = null;
+    collectGarbage();
+    var before = process.memoryUsage().heapUsed;
+    table = app.parseSnapshot(csv);
+    collectGarbage();
+    var tableBytes = process.memoryUsage().heapUsed - before;
+
+    var lookups = 10000;
+    var found = 0;
+    started = process.hrtime();
+    for (i = 0; i < lookups; i++) {
+        if (app.snapshotNearest(table, 35 + (i * 0.0137) % 36, -10 + (i * 0.0291) % 50)) found++;
+    }
+    t = process.hrtime(started);
+
+    console.log('snapshot of ' + table.count + ' stations, ' + runs + ' decodes\n');
+    console.log('  csv              ' + csv.length + ' B, ' + zlib.gzipSync(csv).length + ' B gzipped');
+    console.log('  decode           ' + decodeMs.toFixed(2) + ' ms');
+    console.log('  table            ' + Math.round(tableBytes / 1024) + ' KiB on the heap, ' +
+        Object.keys(table.grid).length + ' grid cells');
+    console.log('  nearest station  ' + ((t[0] * 1e6 + t[1] / 1e3) / lookups).toFixed(2) + ' us per lookup (' +
+        found + ' of ' + lookups + ' found)');
+}
+
+function parseArguments(argv) {
+    var args = { mode: argv[0], updates: 1000, names: [], station: null, log: null, save: null, compare: null,
+        stations: null };
+    for (var i = 1; i < argv.length; i++) {
+        var value = argv[i + 1];
+        switch (argv[i]) {
+            case '--updates': args.updates = parseInt(value, 10); i++; break;
+            case '--station': args.station = value.toUpperCase(); i++; break;
+            case '--log': args.log = value; i++; break;
+            case '--save': args.save = value; i++; break;
+            case '--compare': args.compare = value; i++; break;
+            case '--stations': args.stations = parseInt(value, 10); i++; break;
+            default:
+                if (argv[i].charAt(0) === '-') throw new Error('Unknown argument ' + argv[i]);
+                args.names.push(argv[i]);
+        }
+    }
+    return args;
+}
+
+function main() {
+    var args = parseArguments(process.argv.slice(2));
+    if (args.mode === 'trace') {
+        trace(args);
+    } else if (args.mode === 'bench') {
+        bench(args);
+    } else if (args.mode === 'snapshot') {
+        snapshotBench(args);
+    } else {
+        console.error('Usage: node tools/harness.js trace [--station NAME] [--log LEVEL]\n' +
+            '       node tools/harness.js bench [--updates N] [--save FILE] [--compare FILE] [NAME ...]\n' +
+            '       node tools/harness.js snapshot [--stations N] [--updates N]');
+        process.exitCode = 2;
+    }
+}
+
+if (require.main === module) main();
+
+module.exports = {
+    Harness: Harness,
+    BENCHMARKS: BENCHMARKS,
+    scanHazards: scanHazards,
+    messageSize: messageSize,
+    runBenchmark: runBenchmark
+};
@@ -0,0 +1,258 @@
+// A stand-in for the metar/station, metar/location, metar/subscribe, metar/hazards and metar/snapshot endpoints on
+// olofbeckman.se, for running
+// the companion app against on the host. Reports are made up, and published on a schedule on a clock that the
+// caller drives, so it can run in simulated time as well as in real time.
+
+var http = require('http');
+var url = require('url');
+var zlib = require('zlib');
+
+var LETTERS = 'ABCDEFGHIJKLMNOPQRSTUVWXYZ';
+var HAZARD_KINDS = ['TS', 'TURB', 'ICE', 'IFR', 'MTN', 'VA'];
+
+function pad(n, width) {
+    var s = String(n);
+    while (s.length < width) s = '0' + s;
+    return s;
+}
+
+function MetarServer(options) {
+//Creates a server with options.stations stations, spread over a grid from options.south/west to options.north/east.
+//Each station publishes a new report every options.publishInterval minutes, at its own offset into the interval.
+//There are options.hazards SIGMET and AIRMET polygons over the same area, the same each time for the same options.
+    options = options || {};
+    this.publishInterval = options.publishInterval || 30;
+    this.holdTime = (options.holdTime || 15) * 60000;         // How long a subscription is held without news.
+    this.waiters = [];
+    this.stations = [];
+    this.byName = {};
+    this.now = options.now || Date.now();
+    this.resetStats();
+
+    var count = options.stations || 200;
+    var south = options.south !== undefined ? options.south : 55;
+    var north = options.north !== undefined ? options.north : 69;
+    var west = options.west !== undefined ? options.west : 11;
+    var east = options.east !== undefined ? options.east : 24;
+    var side = Math.ceil(Math.sqrt(count));
+
+    for (var i = 0; i < count; i++) {
+        var name = 'X' + LETTERS[Math.floor(i / 676) % 26] + LETTERS[Math.floor(i / 26) % 26] + LETTERS[i % 26];
+        var station = {
+            name: name,
+            latitude: south + (north - south) * (Math.floor(i / side) + 0.5) / side,
+            longitude: west + (east - west) * ((i % side) + 0.5) / side,
+            offset: (i * 7) % this.publishInterval,
+            served: -1          // Issue time of the report that was last served, for counting cache hits.
+        };
+        this.stations.push(station);
+        this.byName[name] = station;
+    }
+
+    this.hazards = this.makeHazards(options.hazards !== undefined ? options.hazards : 50, south, north, west, east);
+}
+
+MetarServer.prototype.makeHazards = function(count, south, north, west, east) {
+//Returns count made up hazards: star shaped polygons of 5 to 9 corners and 0.1 to 1.2 degrees across, valid from up
+//to an hour before to a few hours after each request, with some that start later.
+    var seed = 12345;
+    function random() {
+        seed = (seed * 1103515245 + 12345) % 2147483648;
+        return seed / 2147483648;
+    }
+    var hazards = [];
+    for (var i = 0; i < count; i++) {
+        var latitude = south + (north - south) * random();
+        var longitude = west + (east - west) * random();
+        var corners = 5 + Math.floor(random() * 5);
+        var radius = 0.1 + 0.5 * random();
+        var polygon = [];
+        for (var c = 0; c < corners; c++) {
+            var angle = 2 * Math.PI * (c + 0.5 * random()) / corners;
+            var r = radius * (0.5 + 0.5 * random());
+            polygon.push([Math.round((latitude + r * Math.sin(angle)) * 1000) / 1000,
+                Math.round((longitude + r * Math.cos(angle) / Math.cos(latitude * Math.PI / 180)) * 1000) / 1000]);
+        }
+        var sigmet = random() < 0.3;
+        hazards.push({
+            id: (sigmet ? 'S' : 'A') + pad(i, 3),
+            type: sigmet ? 'SIGMET' : 'AIRMET',
+            hazard: HAZARD_KINDS[Math.floor(random() * HAZARD_KINDS.length)],
+            from: random() < 0.2 ? 30 + Math.floor(random() * 90) : -Math.floor(random() * 60),   // Minutes from now.
+            to: 120 + Math.floor(random() * 120),
+            polygon: polygon
+        });
+    }
+    return hazards;
+};
+
+MetarServer.prototype.resetStats = function() {
+    this.stats = { requests: 0, station: 0, location: 0, subscribe: 0, pushes: 0, notFound: 0, bytesIn: 0, bytesOut: 0,
+        cacheHits: 0, hazards: 0, snapshot: 0 };
+};
+
+MetarServer.prototype.setTime = function(now) {
+//Moves the server clock, in milliseconds since the epoch. Answers the subscriptions that have a new report, or that
+//have been held long enough.
+    var server = this;
+    this.now = now;
+    this.waiters = this.waiters.filter(function(waiter) {
+        var report = server.report(waiter.station);
+        if (server.issueGroup(report) !== waiter.since) {
+            server.stats.pushes++;
+            server.stats.bytesOut += report.length;
+            waiter.respond({ status: 200, body: report });
+            return false;
+        }
+        if (now >= waiter.expires) {
+            waiter.respond({ status: 204, body: '' });
+            return false;
+        }
+        return true;
+    });
+};
+
+MetarServer.prototype.issueGroup = function(report) {
+//Returns the day and time group of a report, i.e. '181220Z'.
+    return report.split(' ')[1];
+};
+
+MetarServer.prototype.issueTime = function(station) {
+//Returns the issue time in milliseconds of the station's current report.
+    var interval = this.publishInterval * 60000;
+    var offset = station.offset * 60000;
+    return Math.floor((this.now - offset) / interval) * interval + offset;
+};
+
+MetarServer.prototype.report = function(station) {
+//Returns the current report of a station. Conditions vary from one report to the next.
+    var issued = this.issueTime(station);
+    var d = new Date(issued);
+    var seed = Math.floor(issued / 60000) + station.name.charCodeAt(3);
+    var ceiling = 3 + seed % 40;
+    return station.name + ' ' + pad(d.getUTCDate(), 2) + pad(d.getUTCHours(), 2) + pad(d.getUTCMinutes(), 2) + 'Z ' +
+        pad((seed * 10) % 360, 3) + pad(5 + seed % 20, 2) + 'KT 9999 BKN' + pad(ceiling, 3) + ' ' +
+        pad(5 + seed % 10, 2) + '/' + pad(seed % 5, 2) + ' Q' + (1000 + seed % 30);
+};
+
+MetarServer.prototype.snapshot = function() {
+//Returns the current reports of all stations, as a CSV in the layout of NOAA's metars.cache.csv.
+    var server = this;
+    var lines = ['No errors', 'No warnings', '1 ms', 'data source=metars', this.stations.length + ' results',
+        'raw_text,station_id,observation_time,latitude,longitude'];
+    this.stations.forEach(function(station) {
+        lines.push(server.report(station) + ',' + station.name + ',' +
+            new Date(server.issueTime(station)).toISOString().replace('.000', '') + ',' +
+            station.latitude.toFixed(4) + ',' + station.longitude.toFixed(4));
+    });
+    return lines.join('\n') + '\n';
+};
+
+MetarServer.prototype.nearest = function(latitude, longitude) {
+    var best = null;
+    var bestDistance = Infinity;
+    var scale = Math.cos(latitude * Math.PI / 180);
+    this.stations.forEach(function(station) {
+        var dy = station.latitude - latitude;
+        var dx = (station.longitude - longitude) * scale;
+        var distance = dx * dx + dy * dy;
+        if (distance < bestDistance) {
+            bestDistance = distance;
+            best = station;
+        }
+    });
+    return best;
+};
+
+MetarServer.prototype.handle = function(method, requestUrl, respond) {
+//Answers a request. Returns { status: ..., body: ... }, or nothing when respond is given and a subscription is held
+//open. respond is then called with the response later.
+    var parsed = url.parse(requestUrl, true);
+    var response = { status: 404, body: '' };
+    var match;
+
+    this.stats.requests++;
+    this.stats.bytesIn += requestUrl.length;
+
+    if ((match = /\/metar\/station\/([A-Z0-9]+)$/.exec(parsed.pathname))) {
+        this.stats.station++;
+        var station = this.byName[match[1]];
+        if (station) {
+            var issued = this.issueTime(station);
+            if (station.served === issued) {
+                this.stats.cacheHits++;
+            }
+            station.served = issued;
+            response = { status: 200, body: this.report(station) };
+        }
+    } else if ((match = /\/metar\/subscribe\/([A-Z0-9]+)$/.exec(parsed.pathname))) {
+        this.stats.subscribe++;
+        var subscribed = this.byName[match[1]];
+        if (subscribed) {
+            var current = this.report(subscribed);
+            if (this.issueGroup(current) !== parsed.query.since) {
+                response = { status: 200, body: current };
+            } else if (respond) {
+                this.waiters.push({ station: subscribed, since: parsed.query.since, respond: respond,
+                    expires: this.now + this.holdTime });
+                return;
+            } else {
+                response = { status: 204, body: '' };
+            }
+        }
+    } else if (/\/metar\/location$/.test(parsed.pathname)) {
+        this.stats.location++;
+        var nearest = this.nearest(parseFloat(parsed.query.lat), parseFloat(parsed.query.lon));
+        if (nearest) {
+            response = { status: 200, body: nearest.name };
+        }
+    } else if (/\/metar\/snapshot$/.test(parsed.pathname)) {
+        this.stats.snapshot++;
+        response = { status: 200, body: this.snapshot() };
+    } else if (/\/metar\/hazards$/.test(parsed.pathname)) {
+        this.stats.hazards++;
+        var now = Math.floor(this.now / 60000) * 60;
+        response = { status: 200, body: JSON.stringify(this.hazards.map(function(hazard) {
+            return { id: hazard.id, type: hazard.type, hazard: hazard.hazard, from: now + hazard.from * 60,
+                to: now + hazard.to * 60, polygon: hazard.polygon };
+        })) };
+    }
+
+    if (response.status === 404) {
+        this.stats.notFound++;
+    }
+    this.stats.bytesOut += response.body.length;
+    return response;
+};
+
+MetarServer.prototype.listen = function(port, callback) {
+//Serves the endpoints over HTTP on localhost, on the real clock. Answers are gzipped for clients that accept it.
+    var server = this;
+    setInterval(function() {
+        server.setTime(Date.now());
+    }, 1000).unref();
+    return http.createServer(function(request, response) {
+        function send(answer) {
+            var headers = { 'Content-Type': 'text/plain' };
+            var body = answer.body;
+            if (/\bgzip\b/.test(request.headers['accept-encoding'] || '') && (body.length > 1000)) {
+                headers['Content-Encoding'] = 'gzip';
+                body = zlib.gzipSync(body);
+            }
+            response.writeHead(answer.status, headers);
+            response.end(body);
+        }
+        server.setTime(Date.now());
+        var answer = server.handle(request.method, request.url, send);
+        if (answer) send(answer);
+    }).listen(port, '127.0.0.1', callback);
+};
+
+module.exports = MetarServer;
+
+if (require.main === module) {
+    var port = parseInt(process.argv[2], 10) || 8080;
+    new MetarServer().listen(port, function() {
+        console.log('Stand-in METAR server on http://127.0.0.1:' + port + '/metar/');
+    });
+}
@@ -0,0 +1,165 @@
+// Loads the companion app (src/js/pebble-js-app.js) into a sandbox on the host, with stand-ins for the globals
+// PebbleKit JS normally provides. Used by the host side tools in this directory.
+
+var childProcess = require('child_process');
+var fs = require('fs');
+var path = require('path');
+var vm = require('vm');
+
+var APP_PATH = path.join(__dirname, '..', '..', 'src', 'js', 'pebble-js-app.js');
+var RUNWAYS_GENERATOR = path.join(__dirname, '..', 'runways.py');
+var SCHEMA_GENERATOR = path.join(__dirname, '..', 'schema.py');
+var PHRASES_GENERATOR = path.join(__dirname, '..', 'phrases.py');
+
+var generated = null;
+
+function generatedSource() {
+//Returns the generated parts of the companion app, which the wscript builds before concatenating, as { before,
+//after } the app source. Generated once.
+    if (generated === null) {
+        var python = process.env.PYTHON || 'python3';
+        generated = {
+            before: childProcess.execFileSync(python, [PHRASES_GENERATOR, 'js'], { encoding: 'utf8' }),
+            after: childProcess.execFileSync(python, [RUNWAYS_GENERATOR], { encoding: 'utf8' }) +
+                childProcess.execFileSync(python, [SCHEMA_GENERATOR, 'js'], { encoding: 'utf8' })
+        };
+    }
+    return generated;
+}
+
+function appSource() {
+//Returns the companion app source, concatenated the same way the wscript does it.
+    var parts = generatedSource();
+    return parts.before + fs.readFileSync(APP_PATH, 'utf8') + parts.after;
+}
+
+function clockDate(now) {
+//Returns a Date constructor for the sandbox whose now(), and whose dates made without arguments, follow now() instead
+//of the host clock. Everything else is the host Date.
+    function ClockDate() {
+        if (!(this instanceof ClockDate)) return new Date(now()).toString();
+        var args = arguments.length ? Array.prototype.slice.call(arguments) : [now()];
+        return Reflect.construct(Date, args, ClockDate);
+    }
+    ClockDate.prototype = Object.create(Date.prototype, { constructor: { value: ClockDate } });
+    ClockDate.now = now;
+    ClockDate.parse = Date.parse;
+    ClockDate.UTC = Date.UTC;
+    return ClockDate;
+}
+
+function createEnvironment(options) {
+//Returns a fresh sandbox with the companion app loaded. Every sandbox has its own Pebble, localStorage and
+//console, so several instances of the app can run side by side. options.now, if given, is the clock of the sandbox,
+//in ms, for tools that run the app in simulated time.
+    options = options || {};
+    var listeners = {};
+    var storage = {};
+
+    var sandbox = {
+        console: options.console || { log: function() {} },
+        Pebble: {
+            addEventListener: function(name, callback) {
+                listeners[name] = listeners[name] || [];
+                listeners[name].push(callback);
+            },
+            sendAppMessage: options.sendAppMessage || function(message, success) {
+                //Acknowledged asynchronously, like on the phone.
+                if (success) setImmediate(success, { data: { transactionId: 0 } });
+            },
+            openURL: function() {}
+        },
+        localStorage: {
+            getItem: function(key) {
+                return storage.hasOwnProperty(key) ? storage[key] : null;
+            },
+            setItem: function(key, value) {
+                storage[key] = String(value);
+            }
+        },
+        XMLHttpRequest: options.XMLHttpRequest || function() {
+            throw new Error('No XMLHttpRequest stand-in given.');
+        },
+        navigator: { geolocation: options.geolocation || {} },
+        setTimeout: options.setTimeout || setTimeout,
+        clearTimeout: options.clearTimeout || clearTimeout,
+        Date: options.now ? clockDate(options.now) : Date
+    };
+    sandbox.window = sandbox;
+
+    //The app reads its stored configuration as a property as well as through getItem.
+    Object.defineProperty(sandbox.localStorage, 'config', {
+        get: function() { return storage.config; }
+    });
+
+    vm.createContext(sandbox);
+    vm.runInContext(appSource(), sandbox, { filename: APP_PATH });
+
+    sandbox.emit = function(name, event) {
+        (listeners[name] || []).forEach(function(callback) {
+            callback(event || {});
+        });
+    };
+    sandbox.storage = storage;
+    return sandbox;
+}
+
+function createXMLHttpRequest(fetch, defer) {
+//Returns an XMLHttpRequest stand-in that answers every request by calling fetch(method, url, respond), which returns
+//{ status: ..., body: ... }. Synchronous requests are answered in send, asynchronous ones through defer, which
+//defaults to the next turn of the event loop. For asynchronous requests, fetch may instead return nothing and call
+//respond with the response later, i.e. for a long-poll.
+    defer = defer || setImmediate;
+
+    function StandInRequest() {
+        this.readyState = 0;
+        this.status = 0;
+        this.responseText = '';
+    }
+
+    StandInRequest.prototype.open = function(method, url, async) {
+        this.method = method;
+        this.url = url;
+        this.async = async !== false;
+        this.readyState = 1;
+    };
+
+    StandInRequest.prototype.setRequestHeader = function() {};
+
+    StandInRequest.prototype.abort = function() {
+        this.aborted = true;
+    };
+
+    StandInRequest.prototype.send = function() {
+        var request = this;
+        function complete(response) {
+            if (request.aborted) return;
+            request.status = response.status;
+            request.responseText = response.body || '';
+            request.readyState = 4;
+            if (request.onreadystatechange) request.onreadystatechange();
+            if ((request.status === 0) && request.onerror) {
+                request.onerror();
+            } else if (request.onload) {
+                request.onload();
+            }
+        }
+        if (this.async) {
+            var response = fetch(request.method, request.url, function(later) {
+                defer(function() { complete(later); });
+            });
+            if (response) {
+                defer(function() { complete(response); });
+            }
+        } else {
+            complete(fetch(request.method, request.url));
+        }
+    };
+
+    return StandInRequest;
+}
+
+module.exports = {
+    createEnvironment: createEnvironment,
+    createXMLHttpRequest: createXMLHttpRequest
+};
@@ -0,0 +1,212 @@
+// The request schedule of the watch, src/schedule.c, for the tools that simulate watches in JS. It is a port, so a
+// change to schedule.c needs the same change here. The constants are read from src/schedule.h rather than copied,
+// and the names follow the C ones: schedule_due() is Schedule.prototype.due() and so on. Times are in seconds, as
+// time() gives them on the watch.
+
+var fs = require('fs');
+var path = require('path');
+
+var HEADER_PATH = path.join(__dirname, '..', '..', 'src', 'schedule.h');
+
+// The #defines of schedule.h, by name.
+var constants = (function() {
+    var result = {};
+    var define = /^#define (\w+) (\d+)/gm;
+    var text = fs.readFileSync(HEADER_PATH, 'utf8');
+    var match;
+    while ((match = define.exec(text))) {
+        result[match[1]] = parseInt(match[2], 10);
+    }
+    return result;
+})();
+
+var METAR = 'metar';
+var LOCATION = 'location';
+
+var defaultPolicy = {
+    locationInterval: constants.LOCATION_INTERVAL,
+    highInterval: constants.HIGH_INTERVAL,
+    lowInterval: constants.LOW_INTERVAL,
+    baseInterval: constants.BASE_INTERVAL,
+    batSaveInterval: constants.BAT_SAVE_INTERVAL,
+    pushInterval: constants.PUSH_INTERVAL,
+    lowTreshold: constants.LOW_TRESHOLD,
+    highTreshold: constants.HIGH_TRESHOLD
+};
+
+function div(a, b) {
+//Integer division as in C, rounding towards zero.
+    var q = a / b;
+    return q < 0 ? Math.ceil(q) : Math.floor(q);
+}
+
+function Schedule(policy, now) {
+//schedule_init: starts a schedule at now, with no reports and no location yet, and a full battery.
+    this.policy = policy;
+    this.lastWeatherUpdate = 0;
+    this.lastWeatherCheck = now;
+    this.lastLocation = 0;
+    this.initial = 2;
+    this.batSave = false;
+    this.pushActive = false;
+    this.marginal = false;
+    this.tapped = 0;
+    this.charge = 100;
+    this.charging = false;
+    this.metarBudget = { tokens: this.budgetCapacity(constants.BUDGET_METARS), remainder: 0, refilled: now };
+    this.locationBudget = { tokens: this.budgetCapacity(constants.BUDGET_LOCATIONS), remainder: 0, refilled: now };
+    this.deferred = 0;
+    this.deferredAt = 0;
+}
+
+Schedule.prototype.budgetCapacity = function(full) {
+    var capacity = div(this.budget(full) * constants.BUDGET_BURST * 1000, 24 * 60);
+    return capacity < 2000 ? 2000 : capacity;
+};
+
+Schedule.prototype.budgetRefill = function(budget, full, now) {
+    var capacity = this.budgetCapacity(full);
+    var elapsed = now - budget.refilled;
+    if (elapsed > 24 * 60 * 60) {
+        elapsed = 24 * 60 * 60;
+    }
+    if (elapsed > 0) {
+        var added = elapsed * this.budget(full) * 1000 + budget.remainder;
+        budget.tokens += div(added, 24 * 60 * 60);
+        budget.remainder = added % (24 * 60 * 60);
+        if (budget.tokens >= capacity) {
+            budget.tokens = capacity;
+            budget.remainder = 0;
+        }
+    }
+    budget.refilled = now;
+};
+
+Schedule.prototype.requestMatters = function(now) {
+    var policy = this.policy;
+    var timeSinceUpdate = div(now - this.lastWeatherUpdate, 60);
+    return (this.initial > 0) || this.marginal ||
+        ((timeSinceUpdate > policy.lowTreshold) && (timeSinceUpdate < policy.highTreshold)) ||
+        (this.tapped && (div(now - this.tapped, 60) < constants.BUDGET_TAP_WINDOW));
+};
+
+Schedule.prototype.budgetAllows = function(budget, full, now) {
+    if (this.charging) {
+        return true;
+    }
+    this.budgetRefill(budget, full, now);
+    var reserve = this.requestMatters(now) ? 0 : div(this.budgetCapacity(full) * constants.BUDGET_RESERVE, 100);
+    return budget.tokens >= reserve + 1000;
+};
+
+Schedule.prototype.budgetSpend = function(budget, full, now) {
+    this.budgetRefill(budget, full, now);
+    if (!this.charging) {
+        budget.tokens -= 1000;
+    }
+};
+
+Schedule.prototype.reset = function() {
+    this.initial = 2;
+    this.pushActive = false;
+};
+
+Schedule.prototype.interval = function(now) {
+//schedule_interval: the current interval for metar requests, in minutes.
+    var policy = this.policy;
+    var result = policy.baseInterval;
+    var timeSinceUpdate = div(now - this.lastWeatherUpdate, 60);
+
+    if (this.batSave) {
+        result = policy.batSaveInterval;
+    } else if (this.initial === 0) {
+        if ((timeSinceUpdate > policy.lowTreshold) && (timeSinceUpdate < policy.highTreshold)) {
+            result = policy.highInterval;
+        } else {
+            result = policy.lowInterval;
+        }
+    }
+
+    if (this.pushActive && (result < policy.pushInterval)) {
+        result = policy.pushInterval;
+    }
+    return result;
+};
+
+Schedule.prototype.due = function(now) {
+//schedule_due: whether an update should be requested now.
+    var difference = div(now - this.lastWeatherCheck, 60);
+
+    if (difference < this.interval(now)) {
+        return false;
+    }
+    if (!this.budgetAllows(this.metarBudget, constants.BUDGET_METARS, now)) {
+        if (div(now, 60) !== div(this.deferredAt, 60)) {
+            this.deferred++;
+        }
+        this.deferredAt = now;
+        return false;
+    }
+    this.lastWeatherCheck = now;
+    return true;
+};
+
+Schedule.prototype.request = function(now, hasStation) {
+//schedule_request: METAR or LOCATION, what to ask the phone for when an update is due.
+    if (!this.lastLocation || !hasStation) {
+        return LOCATION;
+    }
+    if ((div(now - this.lastLocation, 60) > this.policy.locationInterval) &&
+        this.budgetAllows(this.locationBudget, constants.BUDGET_LOCATIONS, now)) {
+        return LOCATION;
+    }
+    this.lastWeatherCheck = now;
+    this.budgetSpend(this.metarBudget, constants.BUDGET_METARS, now);
+    return METAR;
+};
+
+Schedule.prototype.locationSent = function(now) {
+    this.lastLocation = now;
+    this.budgetSpend(this.locationBudget, constants.BUDGET_LOCATIONS, now);
+};
+
+Schedule.prototype.metarReceived = function(now) {
+    this.lastWeatherUpdate = now;
+    if (this.initial > 0) {
+        this.initial--;
+    }
+};
+
+Schedule.prototype.stationChanged = function() {
+    this.initial = 2;
+};
+
+Schedule.prototype.battery = function(now, charge, charging) {
+    this.budgetRefill(this.metarBudget, constants.BUDGET_METARS, now);
+    this.budgetRefill(this.locationBudget, constants.BUDGET_LOCATIONS, now);
+    this.charge = charge < 0 ? 0 : (charge > 100 ? 100 : charge);
+    this.charging = charging;
+};
+
+Schedule.prototype.tap = function(now) {
+//schedule_tapped. Named so as not to hide the tapped field.
+    this.tapped = now;
+};
+
+Schedule.prototype.budget = function(full) {
+//schedule_budget: the budget per day at the current charge, of a resource with the given full budget.
+    if (this.charging || (this.charge >= constants.BUDGET_FULL_CHARGE)) {
+        return full;
+    }
+    var share = constants.BUDGET_EMPTY_SHARE +
+        div((100 - constants.BUDGET_EMPTY_SHARE) * this.charge, constants.BUDGET_FULL_CHARGE);
+    return div(full * share, 100);
+};
+
+module.exports = {
+    Schedule: Schedule,
+    defaultPolicy: defaultPolicy,
+    constants: constants,
+    METAR: METAR,
+    LOCATION: LOCATION
+};
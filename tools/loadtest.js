@@ -0,0 +1,294 @@
+#!/usr/bin/env node
+// Simulates a fleet of watches, each with its own instance of the companion app, against the stand-in METAR server
+// in tools/lib/metar-server.js. Runs in simulated time with no network, and reports the load on the server for each
+// polling policy.
+//
+// Usage: node tools/loadtest.js [--watches N] [--stations N] [--hours N] [--publish MINUTES] [--policy NAME ...]
+//                               [--location MINUTES] [--push] [--push-interval MINUTES] [--charge PERCENT]
+//
+// Each watch runs the request schedule of src/schedule.c, through its port in tools/lib/schedule.js, so requests
+// bunch up around the time the next report of a station is due as they do on the watch. Policies are 'default' (the
+// intervals in schedule.h), 'battery' (the battery saving setting) and 'fixed:N' (a metar every N minutes). All
+// three are run if none is given. --location and --push-interval override the policy's location interval and the
+// least interval while new reports are pushed. With --push the companion apps subscribe to new reports, and the
+// watches relax their polling while the subscription works. --charge runs the watches at that battery charge, for
+// the energy budget. The watches are started at random over the first base interval, and the phone always answers.
+
+var env = require('./lib/pebble-env');
+var MetarServer = require('./lib/metar-server');
+var schedule = require('./lib/schedule');
+
+function makePolicy(name, args) {
+//Returns the schedule policy called name, with the overrides of args.
+    var policy = {};
+    Object.keys(schedule.defaultPolicy).forEach(function(key) {
+        policy[key] = schedule.defaultPolicy[key];
+    });
+    var fixed = /^fixed:(\d+)$/.exec(name);
+    if (fixed) {
+        // The battery saving interval stands for all of them, as it is the only one used with batSave.
+        policy.batSaveInterval = parseInt(fixed[1], 10);
+    } else if ((name !== 'default') && (name !== 'battery')) {
+        throw new Error('Unknown policy ' + name);
+    }
+    if (args.location !== null) policy.locationInterval = args.location;
+    if (args.pushInterval !== null) policy.pushInterval = args.pushInterval;
+    return policy;
+}
+
+function Watch(fleet, latitude, longitude) {
+//A watch running the request schedule of flightweather.c, with its own companion app instance.
+    var watch = this;
+    this.fleet = fleet;
+    this.latitude = latitude;
+    this.longitude = longitude;
+    this.station = null;
+    this.metar = null;
+    var now = fleet.seconds();
+    this.schedule = new schedule.Schedule(fleet.policy, now - Math.floor(Math.random() * fleet.policy.baseInterval * 60));
+    this.schedule.batSave = fleet.batSave;
+    this.schedule.battery(now, fleet.charge, false);
+    this.unchanged = 0;
+    this.updates = 0;
+    this.delay = 0;             // Summed time from publication to arrival of the reports, in ms.
+
+    this.app = env.createEnvironment({
+        now: function() {
+            return fleet.now;
+        },
+        XMLHttpRequest: fleet.XMLHttpRequest,
+        setTimeout: function(callback, ms) {
+            return fleet.setTimeout(callback, ms);
+        },
+        clearTimeout: function(timer) {
+            fleet.clearTimeout(timer);
+        },
+        geolocation: {
+            getCurrentPosition: function(success) {
+                fleet.defer(function() {
+                    success({ coords: { latitude: watch.latitude, longitude: watch.longitude } });
+                });
+            }
+        },
+        sendAppMessage: function(message, success) {
+            fleet.messages++;
+            fleet.defer(function() {
+                watch.receive(message);
+                success({ data: { transactionId: 0 } });
+            });
+        }
+    });
+    this.app.localStorage.setItem('config', JSON.stringify({ 'location': true, 'push': fleet.push }));
+    this.app.emit('ready', { ready: true });
+}
+
+Watch.prototype.send = function(payload) {
+    this.app.emit('appmessage', { payload: payload });
+};
+
+Watch.prototype.requestUpdate = function() {
+//requestUpdate in flightweather.c, assuming the phone is connected.
+    var now = this.fleet.seconds();
+    if (this.schedule.request(now, this.station !== null) === schedule.LOCATION) {
+        this.schedule.locationSent(now);
+        this.fleet.locationRequests++;
+        this.send({ request: 'location' });
+        return;
+    }
+    this.fleet.metarRequests++;
+    this.send({ request: 'metar', station: this.station });
+};
+
+Watch.prototype.tick = function() {
+//handle_minute_tick in flightweather.c.
+    if (this.schedule.due(this.fleet.seconds())) {
+        this.requestUpdate();
+    }
+};
+
+Watch.prototype.receive = function(message) {
+//The parts of in_received_handler in flightweather.c that drive the schedule, and counts of new reports.
+    var watch = this;
+    if (message.push !== undefined) {
+        this.schedule.pushActive = message.push !== 0;
+    }
+    if (message.metar) {
+        if (!this.metar || (message.metar.slice(0, 12) !== this.metar.slice(0, 12))) {
+            this.metar = message.metar;
+            this.updates++;
+            var server = this.fleet.server;
+            this.delay += this.fleet.now - server.issueTime(server.byName[message.metar.slice(0, 4)]);
+            this.schedule.metarReceived(this.fleet.seconds());
+        } else {
+            this.unchanged++;
+        }
+    }
+    if (message.category !== undefined) {
+        this.schedule.marginal = message.category !== 0;
+    }
+    if (message.station) {
+        if (message.station !== this.station) {
+            this.station = message.station;
+            this.schedule.stationChanged();
+        }
+        this.fleet.defer(function() {
+            watch.requestUpdate();
+        });
+    }
+};
+
+function Fleet(server, count, policy, options) {
+//count watches spread at random over the server's stations, sharing one simulated clock, and all on the schedule
+//policy. options has the push and batSave flags and the battery charge.
+    var fleet = this;
+    this.server = server;
+    this.now = server.now;
+    this.policy = policy;
+    this.push = !!options.push;
+    this.batSave = !!options.batSave;
+    this.charge = options.charge;
+    this.queue = [];
+    this.timers = [];
+    this.messages = 0;
+    this.metarRequests = 0;
+    this.locationRequests = 0;
+    this.XMLHttpRequest = env.createXMLHttpRequest(function(method, url, respond) {
+        return server.handle(method, url, respond);
+    }, function(callback) {
+        fleet.defer(callback);
+    });
+
+    this.watches = [];
+    for (var i = 0; i < count; i++) {
+        var station = server.stations[Math.floor(Math.random() * server.stations.length)];
+        this.watches.push(new Watch(this, station.latitude + Math.random() * 0.2 - 0.1,
+            station.longitude + Math.random() * 0.2 - 0.1));
+    }
+}
+
+Fleet.prototype.seconds = function() {
+//The simulated time as the watch has it, in seconds.
+    return Math.floor(this.now / 1000);
+};
+
+Fleet.prototype.defer = function(callback) {
+//Runs callback once the current event has been handled, like the phone and watch event loops would.
+    this.queue.push(callback);
+};
+
+Fleet.prototype.setTimeout = function(callback, ms) {
+//A timer on the simulated clock. Timers fire at the start of the minute they are due in.
+    var timer = { due: this.now + ms, callback: callback };
+    this.timers.push(timer);
+    return timer;
+};
+
+Fleet.prototype.clearTimeout = function(timer) {
+    var i = this.timers.indexOf(timer);
+    if (i !== -1) this.timers.splice(i, 1);
+};
+
+Fleet.prototype.fireTimers = function() {
+    var now = this.now;
+    var due = this.timers.filter(function(timer) { return timer.due <= now; });
+    this.timers = this.timers.filter(function(timer) { return timer.due > now; });
+    due.forEach(function(timer) { timer.callback(); });
+};
+
+Fleet.prototype.drain = function() {
+    while (this.queue.length) {
+        this.queue.shift()();
+    }
+};
+
+Fleet.prototype.run = function(minutes) {
+    for (var m = 0; m < minutes; m++) {
+        this.now += 60000;
+        this.server.setTime(this.now);
+        this.fireTimers();
+        this.drain();
+        for (var i = 0; i < this.watches.length; i++) {
+            this.watches[i].tick();
+            this.drain();
+        }
+    }
+};
+
+function parseArguments(argv) {
+    var args = { watches: 1000, stations: 200, hours: 24, publish: 30, policies: [], location: null, push: false,
+        pushInterval: null, charge: 100 };
+    for (var i = 0; i < argv.length; i++) {
+        var value = argv[i + 1];
+        switch (argv[i]) {
+            case '--watches': args.watches = parseInt(value, 10); i++; break;
+            case '--stations': args.stations = parseInt(value, 10); i++; break;
+            case '--hours': args.hours = parseFloat(value); i++; break;
+            case '--publish': args.publish = parseInt(value, 10); i++; break;
+            case '--policy': args.policies.push(value); i++; break;
+            case '--location': args.location = parseInt(value, 10); i++; break;
+            case '--push': args.push = true; break;
+            case '--push-interval': args.pushInterval = parseInt(value, 10); i++; break;
+            case '--charge': args.charge = parseInt(value, 10); i++; break;
+            default: throw new Error('Unknown argument ' + argv[i]);
+        }
+    }
+    if (!args.policies.length) args.policies = ['default', 'battery', 'fixed:5'];
+    return args;
+}
+
+function main() {
+    var args = parseArguments(process.argv.slice(2));
+    var minutes = Math.round(args.hours * 60);
+    var seconds = minutes * 60;
+
+    console.log(args.watches + ' watches, ' + args.stations + ' stations publishing every ' + args.publish +
+        ' minutes, ' + args.hours + ' simulated hours, ' + args.charge + '% charge' +
+        (args.push ? ', with push updates.' : '.'));
+
+    args.policies.forEach(function(name) {
+        var policy = makePolicy(name, args);
+        var server = new MetarServer({ stations: args.stations, publishInterval: args.publish });
+        var started = Date.now();
+        var fleet = new Fleet(server, args.watches, policy, { push: args.push, batSave: name !== 'default',
+            charge: args.charge });
+        fleet.run(minutes);
+        var wall = (Date.now() - started) / 1000;
+
+        var stats = server.stats;
+        var unchanged = 0;
+        var updates = 0;
+        var delay = 0;
+        fleet.watches.forEach(function(watch) {
+            unchanged += watch.unchanged;
+            updates += watch.updates;
+            delay += watch.delay;
+        });
+        var replies = unchanged + updates;
+
+        console.log('\npolicy ' + name + ':');
+        console.log('  watch requests   ' + fleet.metarRequests + ' metar, ' + fleet.locationRequests + ' location');
+        console.log('  server requests  ' + stats.requests + ' (' + (stats.requests / seconds).toFixed(2) + '/s, ' +
+            (stats.requests / args.watches / args.hours * 24).toFixed(1) + ' per watch and day)');
+        console.log('    station        ' + stats.station + ', location ' + stats.location + ', subscribe ' +
+            stats.subscribe + ' (' + stats.pushes + ' pushed), hazards ' + stats.hazards + ', snapshot ' +
+            stats.snapshot + ', not found ' + stats.notFound);
+        console.log('  bytes            ' + stats.bytesIn + ' in, ' + stats.bytesOut + ' out (' +
+            Math.round((stats.bytesIn + stats.bytesOut) / seconds) + ' B/s)');
+        console.log('  server cache     ' + (stats.station ? 100 * stats.cacheHits / stats.station : 0).toFixed(1) +
+            '% of station requests for a report already served');
+        console.log('  unchanged        ' + (replies ? 100 * unchanged / replies : 0).toFixed(1) +
+            '% of metar replies had nothing new for the watch');
+        console.log('  new reports      ' + updates + ', on the watch ' +
+            (updates ? delay / updates / 60000 : 0).toFixed(1) + ' minutes after publication on average');
+        console.log('  app messages     ' + fleet.messages + ' to watches');
+        console.log('  simulated in     ' + wall.toFixed(1) + ' s (' + Math.round(stats.requests / wall) +
+            ' requests/s)');
+    });
+}
+
+if (require.main === module) main();
+
+module.exports = {
+    Fleet: Fleet,
+    Watch: Watch
+};
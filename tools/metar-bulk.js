@@ -0,0 +1,275 @@
+#!/usr/bin/env node
+// Decodes a bulk METAR file (NOAA metars.cache.csv style, or one raw METAR per line) with the same parser the
+// companion app uses, and writes the result as a columnar binary file.
+//
+// Usage: node tools/metar-bulk.js <input> [output] [--threads N] [--scale]
+//
+// The input is read once into shared memory and split into lines with Buffer.indexOf, which is memchr (and thus
+// vectorised) underneath. The lines are then decoded in parallel by worker threads, each writing straight into
+// shared column arrays. With --scale the decode is repeated for 1, 2, 4 ... N threads and the throughput of each
+// run is reported.
+//
+// Output layout, all little endian:
+//   "FWMB" | uint32 version | uint32 record count | uint32 column count
+//   per column: char[12] name (zero padded) | uint32 element size
+//   per column: count * element size bytes of data
+// Missing numeric values are stored as the column's minimum value (e.g. -32768 for int16), and so is the ceiling of a
+// record that did not parse. A ceiling of -1 means there is no broken, overcast or obscured layer. Records that did
+// not parse have the FLAG_PARSED bit of flags clear.
+
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+var workerThreads = require('worker_threads');
+
+var FORMAT_VERSION = 2;       // 2 added the category column.
+var NEWLINE = 10;
+var COMMA = 44;
+
+var COLUMNS = [
+    { name: 'station', type: Uint8Array, width: 4 },
+    { name: 'time', type: Uint32Array, width: 1 },
+    { name: 'wind_dir', type: Int16Array, width: 1 },
+    { name: 'wind_speed', type: Int16Array, width: 1 },
+    { name: 'wind_gust', type: Int16Array, width: 1 },
+    { name: 'visibility', type: Int32Array, width: 1 },
+    { name: 'ceiling', type: Int32Array, width: 1 },
+    { name: 'category', type: Uint8Array, width: 1 },
+    { name: 'flags', type: Uint8Array, width: 1 }
+];
+
+var FLAG_PARSED = 1;
+var FLAG_AUTO = 2;
+var FLAG_CAVOK = 4;
+var FLAG_VRB = 8;
+var FLAG_CB = 16;
+
+function missing(type) {
+    if (type === Int16Array) return -32768;
+    if (type === Int32Array) return -2147483648;
+    return 0;
+}
+
+function splitLines(buffer) {
+//Returns the start and end offsets of all METAR records in buffer. For CSV input, everything up to and including
+//the 'raw_text,...' column header is skipped and the first column of each line is the record.
+    var starts = [];
+    var ends = [];
+    var start = 0;
+    var header = buffer.indexOf('raw_text,');
+    var csv = header !== -1;
+    if (csv) {
+        start = buffer.indexOf(NEWLINE, header);
+        start = start === -1 ? buffer.length : start + 1;
+    }
+
+    while (start < buffer.length) {
+        var end = buffer.indexOf(NEWLINE, start);
+        if (end === -1) end = buffer.length;
+        var stop = end;
+        if ((stop > start) && (buffer[stop - 1] === 13)) stop--;
+
+        if (csv) {
+            var comma = buffer.indexOf(COMMA, start);
+            if ((comma !== -1) && (comma < stop)) stop = comma;
+        }
+        if (stop > start) {
+            starts.push(start);
+            ends.push(stop);
+        }
+        start = end + 1;
+    }
+    return { starts: Int32Array.from(starts), ends: Int32Array.from(ends) };
+}
+
+function allocateColumns(count) {
+    return COLUMNS.map(function(column) {
+        var bytes = count * column.width * column.type.BYTES_PER_ELEMENT;
+        return new SharedArrayBuffer(bytes);
+    });
+}
+
+function decodeRange(job) {
+//Decodes the records first to last - 1. Runs in a worker thread.
+    var env = require('./lib/pebble-env').createEnvironment();
+    var input = Buffer.from(job.input);
+    var columns = job.columns.map(function(buffer, i) {
+        return new COLUMNS[i].type(buffer);
+    });
+    var errors = 0;
+
+    for (var i = job.first; i < job.last; i++) {
+        var text = input.toString('latin1', job.starts[i], job.ends[i]);
+        var flags = 0;
+        var metar = null;
+        try {
+            metar = env.parseMETAR(text);
+            flags = FLAG_PARSED;
+        } catch (e) {
+            errors++;
+        }
+
+        for (var c = 0; c < 4; c++) {
+            columns[0][i * 4 + c] = c < text.length ? text.charCodeAt(c) : 0;
+        }
+        columns[1][i] = 0;
+        columns[2][i] = missing(Int16Array);
+        columns[3][i] = missing(Int16Array);
+        columns[4][i] = missing(Int16Array);
+        columns[5][i] = missing(Int32Array);
+        columns[6][i] = missing(Int32Array);
+        columns[7][i] = 0;
+
+        if (metar) {
+            var wind = metar.wind;
+            columns[1][i] = Math.round(metar.time.getTime() / 1000);
+            if (wind.direction === 'VRB') {
+                flags |= FLAG_VRB;
+            } else if (!isNaN(wind.direction)) {
+                columns[2][i] = wind.direction;
+            }
+            if (!isNaN(wind.speed)) columns[3][i] = wind.speed;
+            if (wind.gust !== null && !isNaN(wind.gust)) columns[4][i] = wind.gust;
+            if (metar.cavok) {
+                flags |= FLAG_CAVOK;
+                columns[5][i] = 10000;
+            } else if (metar.visibility !== null && !isNaN(metar.visibility)) {
+                columns[5][i] = Math.round(metar.visibility);
+            }
+            var conditions = env.flightConditions(metar, undefined, env.DEFAULT_MINIMA);
+            columns[6][i] = conditions.ceiling;
+            columns[7][i] = conditions.category;
+            if (metar.auto) flags |= FLAG_AUTO;
+            if ((metar.clouds || []).some(function(layer) { return layer.cumulonimbus; })) flags |= FLAG_CB;
+        }
+        columns[8][i] = flags;
+    }
+    return errors;
+}
+
+function runWorkers(input, lines, columns, threads, callback) {
+//Splits the records evenly over threads workers. Calls callback with the number of unparseable records.
+    var count = lines.starts.length;
+    var chunk = Math.ceil(count / threads);
+    var pending = 0;
+    var errors = 0;
+
+    for (var t = 0; t < threads; t++) {
+        var first = t * chunk;
+        var last = Math.min(count, first + chunk);
+        if (first >= last) break;
+        pending++;
+        var worker = new workerThreads.Worker(__filename, {
+            workerData: {
+                input: input,
+                starts: lines.starts,
+                ends: lines.ends,
+                columns: columns,
+                first: first,
+                last: last
+            }
+        });
+        worker.on('message', function(workerErrors) {
+            errors += workerErrors;
+        });
+        worker.on('error', function(e) {
+            throw e;
+        });
+        worker.on('exit', function() {
+            pending--;
+            if (!pending) callback(errors);
+        });
+    }
+    if (!pending) callback(0);
+}
+
+function writeOutput(file, count, columns) {
+    var header = Buffer.alloc(16 + COLUMNS.length * 16);
+    header.write('FWMB', 0, 'latin1');
+    header.writeUInt32LE(FORMAT_VERSION, 4);
+    header.writeUInt32LE(count, 8);
+    header.writeUInt32LE(COLUMNS.length, 12);
+    COLUMNS.forEach(function(column, i) {
+        header.write(column.name, 16 + i * 16, 12, 'latin1');
+        header.writeUInt32LE(column.width * column.type.BYTES_PER_ELEMENT, 16 + i * 16 + 12);
+    });
+
+    var fd = fs.openSync(file, 'w');
+    fs.writeSync(fd, header);
+    columns.forEach(function(buffer) {
+        fs.writeSync(fd, Buffer.from(buffer));
+    });
+    fs.closeSync(fd);
+}
+
+function parseArguments(argv) {
+    var args = { threads: os.cpus().length, scale: false, files: [] };
+    for (var i = 0; i < argv.length; i++) {
+        if (argv[i] === '--threads') {
+            args.threads = Math.max(1, parseInt(argv[++i], 10) || 1);
+        } else if (argv[i] === '--scale') {
+            args.scale = true;
+        } else {
+            args.files.push(argv[i]);
+        }
+    }
+    return args;
+}
+
+function main() {
+    var args = parseArguments(process.argv.slice(2));
+    if (!args.files.length) {
+        console.error('Usage: node tools/metar-bulk.js <input> [output] [--threads N] [--scale]');
+        process.exit(2);
+    }
+    var inputFile = args.files[0];
+    var outputFile = args.files[1] || path.basename(inputFile).replace(/\.[^.]*$/, '') + '.fwmb';
+
+    var fileBuffer = fs.readFileSync(inputFile);
+    var input = new SharedArrayBuffer(fileBuffer.length);
+    fileBuffer.copy(Buffer.from(input));
+
+    var started = process.hrtime();
+    var lines = splitLines(Buffer.from(input));
+    var split = process.hrtime(started);
+    var count = lines.starts.length;
+    console.log('Split ' + count + ' records in ' + (split[0] * 1e3 + split[1] / 1e6).toFixed(1) + ' ms.');
+
+    var runs = [];
+    if (args.scale) {
+        for (var t = 1; t < args.threads; t *= 2) runs.push(t);
+    }
+    runs.push(args.threads);
+
+    var columns;
+    var baseline = null;
+    (function next() {
+        if (!runs.length) {
+            writeOutput(outputFile, count, columns);
+            console.log('Wrote ' + outputFile + '.');
+            return;
+        }
+        var threads = runs.shift();
+        columns = allocateColumns(count);
+        var start = process.hrtime();
+        runWorkers(input, lines, columns, threads, function(errors) {
+            var elapsed = process.hrtime(start);
+            var seconds = elapsed[0] + elapsed[1] / 1e9;
+            var rate = count / seconds;
+            baseline = baseline || rate;
+            console.log(threads + ' thread(s): ' + Math.round(rate) + ' records/s, ' +
+                (rate / baseline).toFixed(2) + 'x, ' + errors + ' unparseable.');
+            next();
+        });
+    })();
+}
+
+if (workerThreads.isMainThread) {
+    if (require.main === module) main();
+} else {
+    workerThreads.parentPort.postMessage(decodeRange(workerThreads.workerData));
+}
+
+module.exports = {
+    splitLines: splitLines
+};
@@ -0,0 +1,208 @@
+#!/usr/bin/env node
+// Checks that the METAR parser of the companion app gives the same result as the parser it replaced
+// (tools/lib/metar-reference.js), and times both.
+//
+// Usage: node tools/parse-bench.js [input] [--count N] [--rounds N]
+//
+// The input is a bulk METAR file, as for tools/metar-bulk.js. Without one, --count METARs (100000 by default) are
+// made up, with the groups seen in practice: AUTO, gusts, variable wind, CAVOK, statute miles, runway visual range,
+// weather, cloud layers with CB, temperature and pressure. Every field the old parser fills in is compared, except
+// the meaning of weather and cloud abbreviations, which the app now takes from resources/data/phrases.json; the new
+// one adds temperature, dew point and QNH, which the old one does not have. The old parser also gave a layer at 000,
+// e.g. OVC000 or VV000, no height, where the new one gives 0, and that is not counted as a difference. Reports the
+// old parser throws on are counted, but not compared. Any other difference is printed and fails the run.
+
+var fs = require('fs');
+var path = require('path');
+var vm = require('vm');
+var env = require('./lib/pebble-env');
+var splitLines = require('./metar-bulk').splitLines;
+
+var SHOWN_DIFFERENCES = 10;     // Differences printed before the rest are only counted.
+var REFERENCE_PATH = path.join(__dirname, 'lib', 'metar-reference.js');
+
+// The old parser runs in a sandbox of its own, like the app does, as globals cost more in one than outside.
+var reference = (function() {
+    var sandbox = { module: { exports: {} } };
+    vm.createContext(sandbox);
+    vm.runInContext(fs.readFileSync(REFERENCE_PATH, 'utf8'), sandbox, { filename: REFERENCE_PATH });
+    return sandbox.module.exports;
+})();
+
+function pad(n, width) {
+    var s = String(n);
+    while (s.length < width) s = '0' + s;
+    return s;
+}
+
+function makeMetars(count) {
+//Returns count made up METARs, the same each time.
+    var seed = 1;
+    function random(n) {
+        seed = (seed * 1103515245 + 12345) % 2147483648;
+        return Math.floor(seed / 2147483648 * n);
+    }
+    function pick(list) {
+        return list[random(list.length)];
+    }
+    var weather = ['-RA', 'RA', '+RA', '-SHRA', 'SHSN', '-SN', 'BR', 'FG', 'BCFG', 'FZFG', 'TSRA', '+TSRAGR', 'VCSH',
+        '-DZ', 'HZ', 'FU', 'BLSN', 'DRSN', '-FZRA', 'UP'];
+    var clouds = ['FEW', 'SCT', 'BKN', 'OVC'];
+    var metars = [];
+    for (var i = 0; i < count; i++) {
+        var parts = ['X' + String.fromCharCode(65 + random(26), 65 + random(26), 65 + random(26)),
+            pad(1 + random(28), 2) + pad(random(24), 2) + pad(random(2) * 20 + 20 * random(2), 2) + 'Z'];
+        if (random(5) === 0) parts.push('AUTO');
+        var speed = random(35);
+        var unit = random(6) === 0 ? 'MPS' : 'KT';
+        parts.push((random(8) === 0 ? 'VRB' : pad(random(36) * 10, 3)) + pad(speed, 2) +
+            (random(6) === 0 ? 'G' + pad(speed + 10, 2) : '') + unit);
+        if (random(8) === 0) parts.push(pad(random(18) * 10, 3) + 'V' + pad(190 + random(17) * 10, 3));
+        if (random(6) === 0) {
+            parts.push('CAVOK');
+        } else {
+            var visibility = random(10);
+            if (visibility === 0) {
+                parts.push(pick(['1', '2']), pick(['1/2SM', '3/4SM']));
+            } else if (visibility === 1) {
+                parts.push(pick(['10SM', '5SM', '1/2SM']));
+            } else {
+                parts.push(pick(['9999', '8000', '4500', '1200', '0800', '0300']));
+            }
+            if (random(10) === 0) parts.push('R' + pad(1 + random(36), 2) + '/' + pad(200 + random(30) * 50, 4) + 'N');
+            for (var w = random(4) === 0 ? 1 + random(2) : 0; w > 0; w--) parts.push(pick(weather));
+            if (random(12) === 0) {
+                parts.push(pick(['NSC', 'NCD', 'SKC', 'CLR']));
+            } else if (random(20) === 0) {
+                parts.push('VV' + pad(random(6), 3));
+            } else {
+                for (var c = random(4), height = 3; c > 0; c--, height += 5 + random(20)) {
+                    parts.push(pick(clouds) + pad(height, 3) + (random(10) === 0 ? 'CB' : ''));
+                }
+            }
+        }
+        var temperature = random(50) - 20;
+        var dewpoint = temperature - random(10);
+        parts.push((temperature < 0 ? 'M' : '') + pad(Math.abs(temperature), 2) + '/' +
+            (dewpoint < 0 ? 'M' : '') + pad(Math.abs(dewpoint), 2));
+        parts.push(unit === 'KT' && random(3) === 0 ? 'A' + (2950 + random(90)) : 'Q' + (980 + random(50)));
+        if (random(4) === 0) parts.push('NOSIG');
+        metars.push(parts.join(' '));
+    }
+    return metars;
+}
+
+function readMetars(file) {
+    var buffer = fs.readFileSync(file);
+    var lines = splitLines(buffer);
+    var metars = [];
+    for (var i = 0; i < lines.starts.length; i++) {
+        metars.push(buffer.toString('latin1', lines.starts[i], lines.ends[i]));
+    }
+    return metars;
+}
+
+function canonical(value) {
+//Returns value as JSON with sorted keys, and times to the second, as both parsers stamp the current milliseconds.
+//The meanings of abbreviations are left out.
+    if (Object.prototype.toString.call(value) === '[object Date]') return JSON.stringify(value.toISOString().slice(0, 19));
+    if (Array.isArray(value)) return '[' + value.map(canonical).join(',') + ']';
+    if (value && (typeof value === 'object')) {
+        var keys = Object.keys(value).sort().filter(function(key) { return key !== 'meaning'; });
+        return '{' + keys.map(function(key) {
+            return JSON.stringify(key) + ':' + canonical(value[key]);
+        }).join(',') + '}';
+    }
+    return JSON.stringify(value);
+}
+
+function compare(metars, parse) {
+//Parses every METAR with both parsers. Returns the number the old parser threw on, and the differences.
+    var thrown = 0;
+    var differences = [];
+    metars.forEach(function(text) {
+        var expected;
+        try {
+            expected = reference.parseMETAR(text);
+        } catch (e) {
+            thrown++;
+            return;
+        }
+        var actual;
+        try {
+            actual = parse(text);
+        } catch (e) {
+            differences.push(text + '\n    throws ' + e.message);
+            return;
+        }
+        (expected.clouds || []).forEach(function(layer, i) {
+            if ((layer.altitude === null) && actual.clouds && actual.clouds[i] && (actual.clouds[i].altitude === 0)) {
+                layer.altitude = 0;     // Fixed in the new parser.
+            }
+        });
+        Object.keys(expected).forEach(function(key) {
+            var a = canonical(actual[key]), b = canonical(expected[key]);
+            if (a !== b) differences.push(text + '\n    ' + key + ': ' + a + ', was ' + b);
+        });
+    });
+    return { thrown: thrown, differences: differences };
+}
+
+function time(metars, parse, rounds) {
+//Returns METARs parsed per second, over rounds passes. Reports that throw are timed too.
+    var started = process.hrtime();
+    for (var r = 0; r < rounds; r++) {
+        for (var i = 0; i < metars.length; i++) {
+            try {
+                parse(metars[i]);
+            } catch (e) {
+                // Counted in compare().
+            }
+        }
+    }
+    var t = process.hrtime(started);
+    return metars.length * rounds / (t[0] + t[1] / 1e9);
+}
+
+function main() {
+    var args = { input: null, count: 100000, rounds: 3 };
+    var argv = process.argv.slice(2);
+    for (var i = 0; i < argv.length; i++) {
+        if (argv[i] === '--count') {
+            args.count = parseInt(argv[++i], 10);
+        } else if (argv[i] === '--rounds') {
+            args.rounds = parseInt(argv[++i], 10);
+        } else if (argv[i].charAt(0) !== '-') {
+            args.input = argv[i];
+        } else {
+            console.error('Usage: node tools/parse-bench.js [input] [--count N] [--rounds N]');
+            process.exitCode = 2;
+            return;
+        }
+    }
+
+    var metars = args.input ? readMetars(args.input) : makeMetars(args.count);
+    var app = env.createEnvironment();
+    var parse = function(text) { return app.parseMETAR(text); };
+
+    var result = compare(metars, parse);
+    console.log(metars.length + ' METARs' + (args.input ? ' from ' + args.input : ', made up') + ', ' +
+        result.thrown + ' that the old parser throws on.\n');
+    if (result.differences.length) {
+        result.differences.slice(0, SHOWN_DIFFERENCES).forEach(function(difference) { console.log(difference); });
+        console.log('\n' + result.differences.length + ' differences from the old parser.');
+        process.exitCode = 1;
+        return;
+    }
+    console.log('Same result as the old parser for all of them.\n');
+
+    // Warm both up before timing, then alternate, so neither gets the JIT's attention first.
+    time(metars.slice(0, 10000), reference.parseMETAR, 1);
+    time(metars.slice(0, 10000), parse, 1);
+    var old = time(metars, reference.parseMETAR, args.rounds);
+    var now = time(metars, parse, args.rounds);
+    console.log('old parser  ' + Math.round(old) + ' METARs/s');
+    console.log('new parser  ' + Math.round(now) + ' METARs/s  (' + (now / old).toFixed(2) + 'x)');
+}
+
+main();
@@ -0,0 +1,102 @@
+#!/usr/bin/env python
+"""
+Generates the phrase table of the decoded METAR view from resources/data/phrases.json.
+
+    python tools/phrases.py c [phrases.json] > build/src/phrases.auto.h
+    python tools/phrases.py js [phrases.json] > phrases.auto.js
+
+The wscript runs this at build time, and tools/lib/pebble-env.js does the same for the JS when it loads the app on
+the host. The watch gets the text of each phrase and how many numbers it takes, for src/phrases.c to render, and the
+companion app gets the id of each phrase by name, to encode a report with. The companion app also gets its CLOUDS
+and WEATHER abbreviation tables from the phrases named CLOUDS: and WX:, which is why the JS goes before the app
+source rather than after it. A decoded report is a byte string of
+phrase ids, each followed by its numbers as zigzag varints: the sign in the lowest bit, seven bits to a byte, and the
+high bit set on all but the last byte.
+"""
+
+import json
+import os
+import re
+import sys
+
+DEFAULT_JSON = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'resources', 'data', 'phrases.json')
+MAX_PHRASES = 256               # Ids are one byte.
+MAX_ARGS = 2                    # Numbers per phrase, as PHRASE_MAX_ARGS in src/phrases.h.
+
+
+def read_phrases(path):
+    """Returns the (name, text, number of args) of each phrase in the JSON, in id order."""
+    with open(path) as f:
+        phrases = json.load(f)['phrases']
+    names = set()
+    result = []
+    for name, text in phrases:
+        args = text.count('%d')
+        if name in names or text.replace('%d', '').count('%') or args > MAX_ARGS:
+            sys.exit('%s: bad phrase %s' % (path, name))
+        names.add(name)
+        result.append((name, text, args))
+    if len(result) > MAX_PHRASES:
+        sys.exit('%s: more than %d phrases' % (path, MAX_PHRASES))
+    return result
+
+
+def c_string(text):
+    """Returns text as a C string literal, UTF-8 with everything but printable ASCII escaped."""
+    out = ''
+    for byte in bytearray(text.encode('utf-8')):
+        c = chr(byte)
+        if c == '\n':
+            out += '\\n'
+        elif c in '"\\':
+            out += '\\' + c
+        elif 32 <= byte < 127:
+            # A hex escape runs on for as long as there are hex digits, so split the literal after one.
+            out += ('""' if re.match(r'\\x[0-9a-f]{2}$', out[-4:]) and c in '0123456789abcdefABCDEF' else '') + c
+        else:
+            out += '\\x%02x' % byte
+    return '"%s"' % out
+
+
+def generate_c(phrases):
+    return ('// Generated by tools/phrases.py from resources/data/phrases.json. Do not edit.\n'
+            '#pragma once\n'
+            '\n'
+            '#define PHRASE_COUNT %d\n'
+            '\n'
+            'static const char *const phrase_texts[PHRASE_COUNT] = {\n'
+            '%s\n'
+            '};\n'
+            '\n'
+            '// Numbers each phrase takes.\n'
+            'static const uint8_t phrase_args[PHRASE_COUNT] = {\n'
+            '%s\n'
+            '};\n') % (
+                len(phrases),
+                ',\n'.join(('    %s' % c_string(text)) for name, text, args in phrases),
+                '\n'.join(('    %d,' % args).ljust(32) + '// ' + name for name, text, args in phrases))
+
+
+def abbreviations(phrases, prefix):
+    """Returns the phrases named prefix followed by an abbreviation as a JS object literal, in phrase order."""
+    return '{\n%s\n}' % ',\n'.join('    %s: %s' % (json.dumps(name[len(prefix):]), json.dumps(text))
+                                    for name, text, args in phrases if name.startswith(prefix))
+
+
+def generate_js(phrases):
+    return ('// Generated by tools/phrases.py from resources/data/phrases.json. Do not edit.\n'
+            'var PHRASE_IDS = %s;\n'
+            'var PHRASE_ARGS = %s;\n'
+            'var CLOUDS = %s;\n'
+            'var WEATHER = %s;\n') % (
+                json.dumps(dict((name, i) for i, (name, text, args) in enumerate(phrases)), sort_keys=True),
+                json.dumps([args for name, text, args in phrases]),
+                abbreviations(phrases, 'CLOUDS:'),
+                abbreviations(phrases, 'WX:'))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2 or sys.argv[1] not in ('c', 'js'):
+        sys.exit('Usage: %s c|js [phrases.json]' % sys.argv[0])
+    phrases = read_phrases(sys.argv[2] if len(sys.argv) > 2 else DEFAULT_JSON)
+    sys.stdout.write(generate_c(phrases) if sys.argv[1] == 'c' else generate_js(phrases))
@@ -0,0 +1,482 @@
+/*
+   Replays a history of METAR issuance and a trace of bluetooth connectivity through the watch's request schedule
+   (src/schedule.c), on a virtual clock. Weeks are simulated in well under a second, so polling policies can be
+   compared before they are shipped.
+
+   Build and run on the host:
+
+       cc -O2 -Wall -Isrc -o replay tools/replay.c src/schedule.c
+       ./replay [options] [metars]
+
+   metars is a file with one report per line, either raw METARs or NOAA's metars.cache.csv. Only the reports of
+   one station are replayed, given with --station or else the first one in the file. Issue times are taken from
+   the ISO 8601 observation time in CSV lines, or else from the day and time group of the report, counting months
+   from --start. Without a file, --synthetic DAYS makes up half hourly reports with the odd special in between.
+
+   --bluetooth FILE gives a connectivity trace, with one '<minute> <0|1>' line per change, minutes counted from
+   the start of the replay. Bluetooth is connected until the first line says otherwise.
+
+   Options for the policy, in minutes: --location, --high, --low, --base, --low-treshold, --high-treshold and
+   --bat-save-interval, as in schedule.h. --battery replays with the battery saving setting on, --push with the
+   phone pushing new reports while bluetooth is up. --lag is how long after issue a report can be fetched.
+   --charge PERCENT replays with the battery at that charge, for the energy budget in schedule.c, and --drain
+   PERCENT lets it run down by that much a day from there. Low charges are worth a run of their own, e.g.
+   --synthetic 7 --charge 5, as the budget then adds less than a request's thousandth each second.
+
+   The schedule is asked every second, as the watch's tick handler does, and everything else once a minute.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "schedule.h"
+
+#define MAX_LINE 1024
+#define SPECI_PERCENT 5
+
+typedef struct {
+    time_t *items;
+    int count;
+    int size;
+} Times;
+
+typedef struct {
+    int minute;
+    int connected;
+} Change;
+
+typedef struct {
+    long metar_requests;
+    long location_requests;         // Each one is a GPS activation on the phone.
+    long pushes;
+    long delivered;                 // Reports that reached the watch.
+    long missed;                    // Reports that were superseded before they reached the watch.
+    double delay_total;             // Minutes from publication until the watch had the report or a newer one.
+    long delay_worst;
+    double age_total;               // Age of the report on the watch, summed over every minute.
+    long age_worst;
+    long age_samples;
+} Result;
+
+static void addTime(Times *times, time_t t) {
+    if (times->count == times->size) {
+        times->size = times->size ? times->size * 2 : 256;
+        times->items = realloc(times->items, times->size * sizeof(time_t));
+        if (!times->items) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    times->items[times->count++] = t;
+}
+
+static int compareTimes(const void *a, const void *b) {
+    time_t x = *(const time_t *) a;
+    time_t y = *(const time_t *) b;
+    return (x > y) - (x < y);
+}
+
+static long daysFromCivil(int year, int month, int day) {
+    /*
+       Days since 1970-01-01 of a date in the proleptic Gregorian calendar.
+       */
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long yoe = year - era * 400;
+    long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static int daysInMonth(int year, int month) {
+    return daysFromCivil(month == 12 ? year + 1 : year, month == 12 ? 1 : month + 1, 1) -
+        daysFromCivil(year, month, 1);
+}
+
+static int isoTime(const char *line, time_t *t) {
+    /*
+       Finds an ISO 8601 time, i.e. 2015-03-18T12:20:00Z, in line. Returns 1 if there is one.
+       */
+    const char *p;
+    for (p = line; *p; p++) {
+        int year, month, day, hour, minute, second;
+        if (isdigit((unsigned char) *p) &&
+                (sscanf(p, "%4d-%2d-%2dT%2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) == 6)) {
+            *t = ((daysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60 + second;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int dayTimeGroup(const char *line, int *day, int *hour, int *minute) {
+    /*
+       Finds the day and time group of a METAR, i.e. 181220Z, in line. Returns 1 if there is one.
+       */
+    const char *p;
+    for (p = line; *p; p++) {
+        int i;
+        if ((p != line) && (p[-1] != ' ')) {
+            continue;
+        }
+        for (i = 0; (i < 6) && isdigit((unsigned char) p[i]); i++);
+        if ((i == 6) && (p[6] == 'Z') && ((p[7] == ' ') || (p[7] == ',') || !p[7] || (p[7] == '\n'))) {
+            *day = (p[0] - '0') * 10 + p[1] - '0';
+            *hour = (p[2] - '0') * 10 + p[3] - '0';
+            *minute = (p[4] - '0') * 10 + p[5] - '0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void readMetars(const char *file, char *station, int year, int month, Times *times) {
+    /*
+       Reads the issue times of the reports of station from file. If station is empty, it is set to the first
+       station in the file.
+       */
+    FILE *f = fopen(file, "r");
+    char line[MAX_LINE];
+    int last_day = 0;
+
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char name[8];
+        time_t t;
+        int day, hour, minute;
+
+        // The station is the first group of the report, after METAR or SPECI if they are there.
+        const char *p = line;
+        if (!strncmp(p, "METAR ", 6) || !strncmp(p, "SPECI ", 6)) {
+            p += 6;
+        }
+        if ((sscanf(p, "%4[A-Z0-9]", name) != 1) || (strlen(name) != 4) || (p[4] != ' ')) {
+            continue;
+        }
+        if (!*station) {
+            strcpy(station, name);
+        }
+        if (strcmp(station, name)) {
+            continue;
+        }
+
+        if (!isoTime(line, &t)) {
+            if (!dayTimeGroup(line, &day, &hour, &minute)) {
+                continue;
+            }
+            if (day < last_day) {
+                month = month == 12 ? 1 : month + 1;
+                year += month == 1;
+            }
+            last_day = day;
+            if (day > daysInMonth(year, month)) {
+                continue;
+            }
+            t = ((daysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60;
+        }
+        addTime(times, t);
+    }
+    fclose(f);
+}
+
+static void synthesize(int days, Times *times) {
+    /*
+       Makes up days of reports, issued at 20 and 50 past each hour, with the odd special in between.
+       */
+    time_t start = daysFromCivil(2015, 3, 1) * 86400;
+    int half_hour;
+
+    srand(1);
+    for (half_hour = 0; half_hour < days * 48; half_hour++) {
+        time_t issued = start + half_hour * 1800 + 20 * 60;
+        addTime(times, issued);
+        if (rand() % 100 < SPECI_PERCENT) {
+            addTime(times, issued + (1 + rand() % 28) * 60);
+        }
+    }
+}
+
+static Change *readBluetooth(const char *file, int *count) {
+    FILE *f = fopen(file, "r");
+    char line[MAX_LINE];
+    Change *changes = NULL;
+    int size = 0;
+
+    *count = 0;
+    if (!f) {
+        perror(file);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        Change change;
+        if ((line[0] == '#') || (sscanf(line, "%d %d", &change.minute, &change.connected) != 2)) {
+            continue;
+        }
+        if (*count == size) {
+            size = size ? size * 2 : 64;
+            changes = realloc(changes, size * sizeof(Change));
+        }
+        changes[(*count)++] = change;
+    }
+    fclose(f);
+    return changes;
+}
+
+// The simulated watch and phone. {{{
+
+typedef struct {
+    Schedule schedule;
+    const Times *reports;
+    time_t lag;
+    bool bluetooth;
+    bool has_station;
+    bool push;                      // The phone subscribes to new reports.
+    int charge;                     // Battery charge in percent at the start,
+    int drain;                      // and how much it runs down a day.
+    int newest;                     // Index of the newest report on the watch, -1 if none.
+    Result *result;
+} Simulation;
+
+static int published(const Simulation *sim, time_t now) {
+    /*
+       Returns the index of the newest report that can be fetched at now, -1 if none.
+       */
+    int lo = 0, hi = sim->reports->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (sim->reports->items[mid] + sim->lag <= now) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+static void receiveMetar(Simulation *sim, time_t now) {
+    /*
+       The metar part of in_received_handler. The phone always has the newest published report.
+       */
+    int report = published(sim, now);
+    int i;
+    if (report <= sim->newest) {
+        return;
+    }
+    for (i = sim->newest + 1; i <= report; i++) {
+        long delay = (now - sim->reports->items[i] - sim->lag) / 60;
+        if (i < report) {
+            sim->result->missed++;
+        }
+        sim->result->delay_total += delay;
+        if (delay > sim->result->delay_worst) {
+            sim->result->delay_worst = delay;
+        }
+    }
+    sim->result->delivered++;
+    sim->newest = report;
+    schedule_metar_received(&sim->schedule, now);
+    if (sim->push) {
+        sim->schedule.push_active = true;
+    }
+}
+
+static void requestUpdate(Simulation *sim, time_t now) {
+    /*
+       requestUpdate in flightweather.c, with the phone answering right away while bluetooth is up.
+       */
+    if (!sim->bluetooth) {
+        return;
+    }
+    if (schedule_request(&sim->schedule, now, sim->has_station) == SCHEDULE_LOCATION) {
+        schedule_location_sent(&sim->schedule, now);
+        sim->result->location_requests++;
+        // The phone answers with the station, which the watch follows up with a metar request.
+        if (!sim->has_station) {
+            sim->has_station = true;
+            schedule_station_changed(&sim->schedule);
+        }
+        requestUpdate(sim, now);
+        return;
+    }
+    sim->result->metar_requests++;
+    receiveMetar(sim, now);
+}
+
+static void run(Simulation *sim, time_t start, time_t end, const Change *changes, int change_count) {
+    int change = 0;
+    time_t now, second;
+
+    for (now = start; now < end; now += 60) {
+        long minute = (now - start) / 60;
+
+        // battery_state_changed, on every percent.
+        int charge = sim->charge - (int) (minute * sim->drain / (24 * 60));
+        charge = charge < 0 ? 0 : charge;
+        if (charge != sim->schedule.charge) {
+            schedule_battery(&sim->schedule, now, charge, false);
+        }
+
+        // bluetooth_connection_changed. A reconnect is followed by init, which resets the schedule.
+        while ((change < change_count) && (changes[change].minute <= minute)) {
+            bool connected = changes[change++].connected != 0;
+            if (connected && !sim->bluetooth) {
+                sim->bluetooth = true;
+                schedule_reset(&sim->schedule);
+                requestUpdate(sim, now);
+            } else if (!connected) {
+                sim->bluetooth = false;
+                sim->schedule.push_active = false;
+            }
+        }
+
+        // Pushed reports arrive as soon as they are published.
+        if (sim->schedule.push_active && sim->bluetooth && (published(sim, now) > sim->newest)) {
+            sim->result->pushes++;
+            receiveMetar(sim, now);
+        }
+
+        // handle_minute_tick, which the watch runs every second.
+        for (second = now; second < now + 60; second++) {
+            if (schedule_due(&sim->schedule, second)) {
+                requestUpdate(sim, second);
+            }
+        }
+
+        if (sim->newest >= 0) {
+            long age = (now - sim->reports->items[sim->newest]) / 60;
+            sim->result->age_total += age;
+            sim->result->age_samples++;
+            if (age > sim->result->age_worst) {
+                sim->result->age_worst = age;
+            }
+        }
+    }
+}
+// }}}
+
+static int intArgument(int argc, char **argv, int *i) {
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "%s needs a value.\n", argv[*i]);
+        exit(2);
+    }
+    return atoi(argv[++*i]);
+}
+
+int main(int argc, char **argv) {
+    SchedulePolicy policy = schedule_default_policy;
+    Simulation sim;
+    Result result;
+    Times times = { NULL, 0, 0 };
+    Change *changes = NULL;
+    int change_count = 0;
+    char station[8] = "";
+    const char *metars = NULL;
+    const char *bluetooth = NULL;
+    int synthetic = 0;
+    int year = 2015, month = 1;
+    int lag = 3;
+    int charge = 100, drain = 0;
+    bool battery = false, push = false;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        if (!strcmp(arg, "--location")) policy.location_interval = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--high")) policy.high_interval = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--low")) policy.low_interval = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--base")) policy.base_interval = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--low-treshold")) policy.low_treshold = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--high-treshold")) policy.high_treshold = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--bat-save-interval")) policy.bat_save_interval = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--lag")) lag = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--charge")) charge = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--drain")) drain = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--synthetic")) synthetic = intArgument(argc, argv, &i);
+        else if (!strcmp(arg, "--battery")) battery = true;
+        else if (!strcmp(arg, "--push")) push = true;
+        else if (!strcmp(arg, "--station") && (i + 1 < argc)) snprintf(station, sizeof(station), "%s", argv[++i]);
+        else if (!strcmp(arg, "--bluetooth") && (i + 1 < argc)) bluetooth = argv[++i];
+        else if (!strcmp(arg, "--start") && (i + 1 < argc)) {
+            if (sscanf(argv[++i], "%d-%d", &year, &month) != 2) {
+                fprintf(stderr, "--start takes YYYY-MM.\n");
+                return 2;
+            }
+        } else if (arg[0] != '-') metars = arg;
+        else {
+            fprintf(stderr, "Unknown argument %s.\n", arg);
+            return 2;
+        }
+    }
+
+    if (metars) {
+        readMetars(metars, station, year, month, &times);
+    } else if (synthetic > 0) {
+        strcpy(station, "SYNT");
+        synthesize(synthetic, &times);
+    } else {
+        fprintf(stderr, "Usage: replay [options] <metars> | replay [options] --synthetic DAYS\n");
+        return 2;
+    }
+    if (times.count < 2) {
+        fprintf(stderr, "Too few reports to replay.\n");
+        return 1;
+    }
+    qsort(times.items, times.count, sizeof(time_t), compareTimes);
+    if (bluetooth) {
+        changes = readBluetooth(bluetooth, &change_count);
+    }
+
+    // Start on the minute of the first report, and run until an hour after the last.
+    time_t start = times.items[0] / 60 * 60;
+    time_t end = times.items[times.count - 1] + 3600;
+    double days = (end - start) / 86400.0;
+
+    memset(&result, 0, sizeof(result));
+    memset(&sim, 0, sizeof(sim));
+    schedule_init(&sim.schedule, &policy, start);
+    sim.schedule.bat_save = battery;
+    sim.reports = &times;
+    sim.lag = lag * 60;
+    sim.bluetooth = true;
+    sim.push = push;
+    sim.charge = charge;
+    sim.drain = drain;
+    sim.newest = -1;
+    sim.result = &result;
+
+    clock_t started = clock();
+    run(&sim, start, end, changes, change_count);
+    double wall = (double) (clock() - started) / CLOCKS_PER_SEC;
+
+    printf("%s: %d reports over %.1f days, policy base %d, low %d, high %d between %d and %d, location %d%s%s, "
+        "%d%% charge", station, times.count, days, policy.base_interval, policy.low_interval, policy.high_interval,
+        policy.low_treshold, policy.high_treshold, policy.location_interval, battery ? ", battery saving" : "",
+        push ? ", push" : "", charge);
+    if (drain) {
+        printf(" running down %d%% a day", drain);
+    }
+    printf(".\n");
+    printf("  requests per day   %.1f metar, %.1f location\n", result.metar_requests / days,
+        result.location_requests / days);
+    printf("  GPS activations    %ld (%.1f per day)\n", result.location_requests, result.location_requests / days);
+    printf("  held back          %ld minutes by the energy budget\n", (long) sim.schedule.deferred);
+    if (push) {
+        printf("  pushed reports     %ld\n", result.pushes);
+    }
+    printf("  reports            %ld delivered, %ld superseded before delivery\n", result.delivered,
+        result.missed);
+    printf("  delivery delay     %.1f minutes average, %ld worst\n",
+        (result.delivered + result.missed) ? result.delay_total / (result.delivered + result.missed) : 0.0,
+        result.delay_worst);
+    printf("  age on the watch   %.1f minutes average, %ld worst\n",
+        result.age_samples ? result.age_total / result.age_samples : 0.0, result.age_worst);
+    printf("  simulated in       %.3f s\n", wall);
+
+    free(times.items);
+    free(changes);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#!/usr/bin/env python
+"""
+Generates the runway table of the companion app from resources/data/runways.csv.
+
+    python tools/runways.py [runways.csv] > runways.auto.js
+
+The wscript runs this at build time and adds the output to the companion app, and tools/lib/pebble-env.js does the
+same when it loads the app on the host. The table is one fixed size record per runway, sorted by station, so the
+app can binary search it without building an index:
+
+    char[4] station | int16 elevation (ft) | uint16 heading (degrees) | char suffix (L, R, C or 0) |
+    int8 magnetic variation (degrees, east positive)
+
+all little endian, and base64 encoded into a string.
+"""
+
+import base64
+import csv
+import os
+import re
+import struct
+import sys
+
+DEFAULT_CSV = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'resources', 'data', 'runways.csv')
+RECORD = struct.Struct('<4shHcb')
+DESIGNATOR = re.compile(r'^(\d\d)([LRC]?)(?:/(\d\d)([LRC]?))?$')
+
+
+def read_runways(path):
+    """Returns (station, elevation, heading, suffix, variation) tuples from the CSV, sorted by station and heading."""
+    runways = []
+    variations = {}
+    with open(path) as f:
+        rows = csv.reader(line for line in f if line.strip() and not line.startswith('#'))
+        header = next(rows)
+        for number, row in enumerate(rows, 2):
+            fields = dict(zip(header, (field.strip() for field in row)))
+            station = fields['station'].upper()
+            match = DESIGNATOR.match(fields['runway'].upper())
+            if len(station) != 4 or not match:
+                sys.exit('%s: bad station or runway on line %d' % (path, number))
+            heading = int(fields['heading']) if fields.get('heading') else int(match.group(1)) * 10
+            if not 1 <= heading <= 360:
+                sys.exit('%s: bad heading on line %d' % (path, number))
+            if not re.match(r'^-?\d+$', fields.get('variation') or '') or \
+                    variations.setdefault(station, int(fields['variation'])) != int(fields['variation']) or \
+                    not -90 <= int(fields['variation']) <= 90:
+                sys.exit('%s: bad or inconsistent variation on line %d' % (path, number))
+            runways.append((station, int(fields['elevation']), heading, match.group(2), int(fields['variation'])))
+    return sorted(runways)
+
+
+def generate(runways):
+    table = b''.join(RECORD.pack(station.encode('ascii'), elevation, heading, (suffix or '\0').encode('ascii'),
+                                 variation)
+                     for station, elevation, heading, suffix, variation in runways)
+    return ('// Generated by tools/runways.py from resources/data/runways.csv. Do not edit.\n'
+            'var RUNWAY_RECORD = %d;\n'
+            'var RUNWAY_TABLE = "%s";\n') % (RECORD.size, base64.b64encode(table).decode('ascii'))
+
+
+if __name__ == '__main__':
+    sys.stdout.write(generate(read_runways(sys.argv[1] if len(sys.argv) > 1 else DEFAULT_CSV)))
@@ -0,0 +1,201 @@
+#!/usr/bin/env python
+"""
+Generates the app message schema of the watch and the companion app from the appKeys in appinfo.json.
+
+    python tools/schema.py c [appinfo.json] > build/src/message_schema.auto.h
+    python tools/schema.py js [appinfo.json] > schema.auto.js
+
+The wscript runs this at build time, and tools/lib/pebble-env.js does the same for the JS when it loads the app on
+the host. The C header has the key enum, a Message struct that message_read fills in one pass over a received
+dictionary, and an accessor for each key that returns its value with the type below. The JS has the keys and their
+types, so the companion app can check what it sends.
+"""
+
+import json
+import os
+import re
+import sys
+
+DEFAULT_APPINFO = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'appinfo.json')
+
+# Type of each key, as the watch receives it. Every key in appinfo.json needs one. Some keys are only ever sent by
+# the watch, and 'stats' is a flag from the phone, but the counters the other way.
+TYPES = {
+    'metar': 'cstring',
+    'request': 'cstring',
+    'station': 'cstring',
+    'status': 'int',
+    'init': 'int',
+    'location': 'int',
+    'net': 'int',
+    'bat': 'int',
+    'largefont': 'int',
+    'seconds': 'int',
+    'updated': 'uint',
+    'category': 'int',
+    'ceiling': 'int',
+    'visibility': 'int',
+    'wind': 'int',
+    'stats': 'int',
+    'trace': 'uint',
+    'roundtrip': 'uint',
+    'render': 'uint',
+    'push': 'int',
+    'wx': 'int',
+    'temperature': 'int',
+    'dewpoint': 'int',
+    'qnh': 'int',
+    'elevation': 'int',
+    'runways': 'bytes',
+    'winddir': 'int',
+    'gust': 'int',
+    'hazard': 'int',
+    'phrases': 'bytes'
+}
+
+# What message_read accepts for each type. Integers may come signed or unsigned, at any width.
+C_TYPES = {
+    'cstring': 'MESSAGE_TYPE_CSTRING',
+    'int': 'MESSAGE_TYPE_INTEGER',
+    'uint': 'MESSAGE_TYPE_INTEGER',
+    'bytes': 'MESSAGE_TYPE_BYTES'
+}
+
+C_PRELUDE = '''\
+// Generated by tools/schema.py from appinfo.json. Do not edit.
+#pragma once
+
+// Keys for app message.
+enum {
+%(keys)s
+};
+
+#define MESSAGE_SLOTS %(slots)d             // One more than the largest key.
+
+// The tuples of a received message, by key. Missing keys, and keys with a tuple of the wrong type, are NULL.
+typedef struct {
+    const Tuple *tuples[MESSAGE_SLOTS];
+    int unknown;                        // Tuples that were left out because of their key or type.
+} Message;
+
+enum {
+    MESSAGE_TYPE_NONE = 0,
+    MESSAGE_TYPE_CSTRING = 1 << TUPLE_CSTRING,
+    MESSAGE_TYPE_INTEGER = (1 << TUPLE_INT) | (1 << TUPLE_UINT),
+    MESSAGE_TYPE_BYTES = 1 << TUPLE_BYTE_ARRAY
+};
+
+// The tuple types accepted for each key.
+static const uint8_t message_types[MESSAGE_SLOTS] = {
+%(types)s
+};
+
+static inline void message_read(DictionaryIterator *iter, Message *message) {
+    /*
+       Reads all tuples of a received message into message, in one pass over the dictionary.
+       */
+    memset(message, 0, sizeof(*message));
+    for (Tuple *tuple = dict_read_first(iter); tuple; tuple = dict_read_next(iter)) {
+        if ((tuple->key < MESSAGE_SLOTS) && (message_types[tuple->key] & (1 << tuple->type))) {
+            message->tuples[tuple->key] = tuple;
+        } else {
+            message->unknown++;
+        }
+    }
+}
+
+static inline bool message_has(const Message *message, uint32_t key) {
+    return message->tuples[key] != NULL;
+}
+
+static inline int32_t message_int(const Message *message, uint32_t key, int32_t missing) {
+    /*
+       Returns the value of an integer tuple, whatever width the phone chose to send it with, or missing if there
+       is none.
+       */
+    const Tuple *tuple = message->tuples[key];
+    if (!tuple) {
+        return missing;
+    }
+    switch (tuple->length) {
+        case 1:
+            return tuple->type == TUPLE_INT ? tuple->value->int8 : tuple->value->uint8;
+        case 2:
+            return tuple->type == TUPLE_INT ? tuple->value->int16 : tuple->value->uint16;
+        default:
+            return tuple->value->int32;
+    }
+}
+
+static inline const char *message_cstring(const Message *message, uint32_t key) {
+    const Tuple *tuple = message->tuples[key];
+    return tuple ? tuple->value->cstring : NULL;
+}
+
+static inline const uint8_t *message_bytes(const Message *message, uint32_t key, uint16_t *length) {
+    const Tuple *tuple = message->tuples[key];
+    *length = tuple ? tuple->length : 0;
+    return tuple ? tuple->value->data : NULL;
+}
+
+// Accessors for each key.
+'''
+
+C_ACCESSORS = {
+    'cstring': 'static inline const char *message_%(name)s(const Message *message) {\n'
+               '    return message_cstring(message, %(key)s);\n'
+               '}\n',
+    'int': 'static inline int32_t message_%(name)s(const Message *message, int32_t missing) {\n'
+           '    return message_int(message, %(key)s, missing);\n'
+           '}\n',
+    'uint': 'static inline uint32_t message_%(name)s(const Message *message, uint32_t missing) {\n'
+            '    return (uint32_t) message_int(message, %(key)s, (int32_t) missing);\n'
+            '}\n',
+    'bytes': 'static inline const uint8_t *message_%(name)s(const Message *message, uint16_t *length) {\n'
+             '    return message_bytes(message, %(key)s, length);\n'
+             '}\n'
+}
+
+
+def read_keys(path):
+    """Returns the (name, key) pairs of the appKeys in appinfo.json, sorted by key."""
+    with open(path) as f:
+        keys = json.load(f)['appKeys']
+    for name, key in keys.items():
+        if not re.match(r'^[a-z][a-z0-9_]*$', name) or not 0 <= key < 256:
+            sys.exit('%s: bad app key %s = %s' % (path, name, key))
+        if name not in TYPES:
+            sys.exit('%s: app key %s has no type in tools/schema.py' % (path, name))
+    if len(set(keys.values())) != len(keys):
+        sys.exit('%s: app keys are not unique' % path)
+    return sorted(keys.items(), key=lambda item: item[1])
+
+
+def generate_c(keys):
+    slots = keys[-1][1] + 1
+    types = dict((key, C_TYPES[TYPES[name]]) for name, key in keys)
+    names = dict((key, name) for name, key in keys)
+    text = C_PRELUDE % {
+        'keys': ',\n'.join('    %s_KEY = 0x%x' % (name.upper(), key) for name, key in keys),
+        'slots': slots,
+        'types': '\n'.join(('    %s,' % types.get(key, 'MESSAGE_TYPE_NONE')).ljust(32) +
+                            ('// %s' % names.get(key, '(unused)'))
+                            for key in range(slots))
+    }
+    return text + '\n'.join(C_ACCESSORS[TYPES[name]] % {'name': name, 'key': name.upper() + '_KEY'}
+                            for name, key in keys)
+
+
+def generate_js(keys):
+    return ('// Generated by tools/schema.py from appinfo.json. Do not edit.\n'
+            'var MESSAGE_KEYS = %s;\n'
+            'var MESSAGE_TYPES = %s;\n') % (
+                json.dumps(dict(keys), sort_keys=True),
+                json.dumps(dict((name, TYPES[name]) for name, key in keys), sort_keys=True))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2 or sys.argv[1] not in ('c', 'js'):
+        sys.exit('Usage: %s c|js [appinfo.json]' % sys.argv[0])
+    keys = read_keys(sys.argv[2] if len(sys.argv) > 2 else DEFAULT_APPINFO)
+    sys.stdout.write(generate_c(keys) if sys.argv[1] == 'c' else generate_js(keys))